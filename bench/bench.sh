@@ -0,0 +1,76 @@
+#!/bin/sh
+# Assembler speed and code generation benchmark. Run with "make bench".
+# Usage: bench.sh <assembler> <generator> <work dir>
+# BENCH_UPDATE=1 replaces the baseline with the current results.
+#
+# Code size and instruction bytes fetched per data byte moved are
+# deterministic. Any increase fails the benchmark. Throughput and peak
+# memory depend on the machine and only warn on large changes.
+# Streamed C headers must compile and match the bytes of the file build.
+
+set -e
+
+AS=$1
+GEN=$2
+DIR=$3
+BASELINE=$(dirname "$0")/baseline.txt
+RESULTS=$DIR/results.txt
+
+mkdir -p "$DIR"
+echo "# case code_bytes fetched_per_moved lines_per_sec peak_kib" > "$RESULTS"
+
+for CASE in "loops 20000" "descriptors 20000" "mnemonics 2000"; do
+	set -- $CASE
+	"$GEN" "$1" "$2" > "$DIR/$1.s"
+	"$AS" -j1 --stats --metrics "$DIR/$1.s" "$DIR/$1.h" > "$DIR/$1.log"
+
+	awk -v name="$1" '
+		/^Metrics / { code += $4; fetched += $10; moved += $13 }
+		/^Lines:/ { gsub(/\(/, "", $3); lps = $3 }
+		/^Peak memory:/ { kib = $3 }
+		END { printf("%s %d %.4f %d %d\n", name, code, (moved ? fetched / moved : 0), lps, kib) }
+	' "$DIR/$1.log" >> "$RESULTS"
+done
+
+# The region map makes streaming hold back DMAMOV CCRs and rewrite them in place.
+printf '0x0 0x2FFFFFFF normal-wb\n0x30000000 0xFFFFFFFF device\n' > "$DIR/regions.txt"
+for CASE in loops descriptors; do
+	"$AS" -r "$DIR/regions.txt" "$DIR/$CASE.s" "$DIR/$CASE.file.h"
+	"$AS" -r "$DIR/regions.txt" - "$DIR/$CASE.stream.h" < "$DIR/$CASE.s"
+	printf '#include "%s.stream.h"\nint main(void) { return program[0]; }\n' "$CASE" > "$DIR/$CASE.stream.c"
+	if ! ${CC:-cc} -c "$DIR/$CASE.stream.c" -o "$DIR/$CASE.stream.o" 2> "$DIR/$CASE.stream.log"; then
+		echo "$CASE: Streamed header doesn't compile. See $DIR/$CASE.stream.log."
+		exit 1
+	fi
+
+	grep -o '0x[0-9A-F][0-9A-F]' "$DIR/$CASE.file.h" > "$DIR/$CASE.file.txt"
+	grep -o '0x[0-9A-F][0-9A-F]' "$DIR/$CASE.stream.h" > "$DIR/$CASE.stream.txt"
+	if ! cmp -s "$DIR/$CASE.file.txt" "$DIR/$CASE.stream.txt"; then
+		echo "$CASE: Streamed code differs from the file build."
+		exit 1
+	fi
+done
+
+if [ -n "$BENCH_UPDATE" ]; then
+	cp "$RESULTS" "$BASELINE"
+	echo "Baseline updated."
+	exit 0
+fi
+
+awk '
+	FNR == 1 { file++ }
+	/^#/ { next }
+	file == 1 { code[$1] = $2; fpm[$1] = $3; lps[$1] = $4; kib[$1] = $5; next }
+	!($1 in code) { print $1 ": No baseline."; next }
+	{
+		printf("%-12s code %8d B (%+d)  fetched/moved %.4f (%+.4f)  %9d lines/s (%+.0f%%)  %6d KiB (%+.0f%%)\n",
+		       $1, $2, $2 - code[$1], $3, $3 - fpm[$1], $4, ($4 / lps[$1] - 1) * 100, $5, ($5 / kib[$1] - 1) * 100)
+
+		if($2 > code[$1]) { print "  REGRESSION: Code size grew."; bad = 1 }
+		if($3 > fpm[$1]) { print "  REGRESSION: More instruction bytes fetched per data byte moved."; bad = 1 }
+		if($4 < lps[$1] / 2) print "  Warning: Throughput less than half of the baseline."
+		if($5 > kib[$1] * 1.5) print "  Warning: Peak memory grew by more than 50%."
+		if($2 < code[$1] || $3 < fpm[$1]) print "  Improved. Run \"BENCH_UPDATE=1 make bench\" to update the baseline."
+	}
+	END { exit bad }
+' "$BASELINE" "$RESULTS"
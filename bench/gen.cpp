@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+
+
+// Synthetic source generator for "make bench".
+// Usage: gen <loops|descriptors|mnemonics> <count>
+
+
+
+static uint32_t g_rng = 0x2545F491u;
+
+static uint32_t rnd(uint32_t max)
+{
+	g_rng ^= g_rng<<13;
+	g_rng ^= g_rng>>17;
+	g_rng ^= g_rng<<5;
+
+	return g_rng % max;
+}
+
+// Nested counted loops in forever loops with peripheral flow control.
+static void genLoops(uint32_t count)
+{
+	puts("# Generated: loops");
+	puts("DMAMOV CCR SB16 SS64 DB16 DS64");
+	puts("DMAMOV SAR 0x20000000");
+	puts("DMAMOV DAR 0x30000000");
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(i % 16 == 0)
+		{
+			printf("DMAFLUSHP P%" PRIu32 "\n", i % 32);
+			puts("DMALPFE");
+			printf("\tDMAWFP %" PRIu32 ", periph\n", i % 32);
+			printf("\tDMALP %" PRIu32 "\n", 1 + rnd(16));
+			puts("\t\tDMALDB");
+			puts("\t\tDMASTB");
+			puts("\tDMALPENDB");
+			printf("\tDMALDPS P%" PRIu32 "\n", i % 32);
+			puts("\tDMASTS");
+			puts("DMALPEND");
+			continue;
+		}
+
+		printf("DMALP %" PRIu32 "\n", 1 + rnd(8));
+		printf("\tDMALP %" PRIu32 "\n", 1 + rnd(64));
+		puts("\t\tDMALD");
+		puts("\t\tDMAST");
+		puts("\tDMALPEND");
+		puts("\tDMAADDH DAR, 0x400");
+		puts("DMALPEND");
+	}
+	puts("DMAEND");
+}
+
+// A long list of copy descriptors as emitted by driver tooling.
+static void genDescriptors(uint32_t count)
+{
+	puts("# Generated: descriptors");
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const uint32_t src = 0x20000000u + rnd(0x100000) * 64;
+		const uint32_t dst = 0x30000000u + rnd(0x100000) * 64;
+		switch(rnd(4))
+		{
+			case 0:
+				puts("DMAMOV CCR SB8 SS64 DB8 DS64");
+				printf("DMAMOV SAR 0x%08" PRIX32 "\n", src);
+				printf("DMAMOV DAR 0x%08" PRIX32 "\n", dst);
+				printf("DMALP %" PRIu32 "\n", 1 + rnd(32));
+				puts("\tDMALD");
+				puts("\tDMAST");
+				puts("DMALPEND");
+				break;
+			case 1:
+				printf("COPY2D 0x%08" PRIX32 ", 0x%08" PRIX32 ", %" PRIu32 ", %" PRIu32 ", 4096, 2048\n",
+				       src, dst, 64 * (1 + rnd(16)), 1 + rnd(64));
+				break;
+			case 2:
+				printf("ZERO 0x%08" PRIX32 ", %" PRIu32 "\n", dst + rnd(8), 1 + rnd(4096));
+				break;
+			case 3:
+				printf("FILL 0x%08" PRIX32 ", %" PRIu32 ", 0x%08" PRIX32 "\n", dst, 8 * (1 + rnd(512)), src);
+				break;
+		}
+	}
+	puts("DMAEND");
+}
+
+// Every instruction, pseudo instruction and directive.
+static void genMnemonics(uint32_t count)
+{
+	puts("# Generated: mnemonics");
+	puts(".pipeline bench rx=P1 src=0x10000000 buf0=0x20000000 buf1=0x20001000 size=4096 dst=0x30000000");
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const uint32_t p = rnd(32);
+		puts("DMAMOV CCR SB4 SS32 DB4 DS32");
+		printf("DMAMOV SAR 0x%08" PRIX32 "\n", 0x20000000u + rnd(0x10000) * 4);
+		printf("DMAMOV DAR 0x%08" PRIX32 "\n", 0x30000000u + rnd(0x10000) * 4);
+		printf("DMAADDH SAR, %" PRIu32 "\n", rnd(0x10000));
+		printf("DMAADNH DAR, %" PRIu32 "\n", rnd(0x10000));
+		printf("DMAFLUSHP P%" PRIu32 "\n", p);
+		printf("DMAWFP %" PRIu32 ", single\n", p);
+		puts("DMALD");
+		puts("DMALDS");
+		puts("DMALDB");
+		printf("DMALDP P%" PRIu32 "\n", p);
+		printf("DMALDPS P%" PRIu32 "\n", p);
+		printf("DMALDPB P%" PRIu32 "\n", p);
+		puts("DMAST");
+		puts("DMASTS");
+		puts("DMASTB");
+		printf("DMASTP P%" PRIu32 "\n", p);
+		printf("DMASTPS P%" PRIu32 "\n", p);
+		printf("DMASTPB P%" PRIu32 "\n", p);
+		puts("DMASTZ");
+		puts("DMALP 4");
+		puts("\tDMALP 2");
+		puts("\t\tDMANOP");
+		puts("\tDMALPENDS");
+		puts("\tDMARMB");
+		puts("\tDMAWMB");
+		puts("DMALPENDB");
+		puts("DMALP 2");
+		puts("\tDMANOP");
+		puts("DMALPEND");
+		puts("DMALPFE");
+		puts("\tDMANOP");
+		puts("DMALPEND");
+		printf("DMASEV %" PRIu32 "\n", 8 + rnd(24));
+		printf("DMAWFE %" PRIu32 "\n", 8 + rnd(24));
+		printf("DMAWFE %" PRIu32 ", invalid\n", 8 + rnd(24));
+		printf("DMAGO %" PRIu32 ", 0x%08" PRIX32 "\n", rnd(8), 0x40000000u + rnd(0x10000) * 4);
+		printf("COPY2D 0x20000000, 0x30000000, 256, %" PRIu32 ", 1024, 512\n", 1 + rnd(32));
+		printf("ZERO 0x30000000, %" PRIu32 "\n", 1 + rnd(1024));
+		printf("FILL 0x30000000, %" PRIu32 ", 0x20000000\n", 1 + rnd(1024));
+		printf("PERIPH_%s P%" PRIu32 ", 32, %" PRIu32 "\n", (rnd(2) ? "RX" : "TX"), p, 1 + rnd(64));
+	}
+	puts("DMAEND");
+	puts("DMAKILL");
+}
+
+int main(int argc, char *const argv[])
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <loops|descriptors|mnemonics> <count>\n", argv[0]);
+		return 1;
+	}
+
+	const uint32_t count = strtoul(argv[2], nullptr, 0);
+	if(strcmp(argv[1], "loops") == 0)            genLoops(count);
+	else if(strcmp(argv[1], "descriptors") == 0) genDescriptors(count);
+	else if(strcmp(argv[1], "mnemonics") == 0)   genMnemonics(count);
+	else
+	{
+		fprintf(stderr, "Unknown source type '%s'.\n", argv[1]);
+		return 1;
+	}
+
+	return 0;
+}
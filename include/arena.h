@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "types.h"
+
+
+#define ARENA_BLOCK_SIZE  (16u * 1024)
+
+
+// Growable code buffer made of fixed size blocks. Growing never
+// moves already emitted code. Blocks are kept for reuse on clear().
+struct CodeArena
+{
+	std::vector<std::unique_ptr<u8[]>> blocks;
+	u32 used = 0;
+
+	int append(const void *const data, u32 size);
+	void read(u32 pos, void *const out, u32 size) const;
+	void write(u32 pos, const void *const data, u32 size);
+	void copyTo(std::vector<u8> &out) const;
+	u32 size(void) const {return used;}
+	void truncate(u32 size) {if(size < used) used = size;}
+	void clear(void) {used = 0;}
+};
@@ -1,13 +1,33 @@
 #pragma once
 
+#include <vector>
 #include "types.h"
+#include "latency.h"
+#include "contention.h"
+#include "program.h"
 
 
 #define INBUF_SIZE   (1024)
-#define OUTBUF_SIZE  (1024 * 1024)
 #define MAX_TOKENS   (13)
 
 
+typedef struct
+{
+	LatencyOpts latency;
+	ContentionOpts contention;
+	bool events;             // Print the SEV -> WFE graph and check for deadlocks.
+	const char *regionFile;  // Memory region map for picking AXI cache attributes.
+	const char *profileFile; // Execution counts per source line.
+	u32 jobs;                // Threads for assembling large files. 0 = all cores.
+	bool verbose;            // Print the parser trace and bytecode.
+	bool stats;              // Print assembler performance statistics.
+	bool metrics;            // Simulate the programs and print code efficiency metrics.
+	bool cache;              // Only reassemble blocks changed since the last run.
+	bool watch;              // Reassemble when an input file changes.
+	const char *socketPath;  // Unix socket to push the bytecode to.
+	bool binary;             // Write raw bytecode instead of a C header.
+} AsmOpts;
+
 
 int emitAdd(u32 argc, const char *const argv[MAX_TOKENS]);
 int emitEnd(u32 argc, const char *const argv[MAX_TOKENS]);
@@ -24,4 +44,12 @@ int emitSt(u32 argc, const char *const argv[MAX_TOKENS]);
 int emitWfe(u32 argc, const char *const argv[MAX_TOKENS]);
 int emitWfp(u32 argc, const char *const argv[MAX_TOKENS]);
 
-int dma330as(const char *const inFile, const char *const outFile);
+int emitLine(const char *const fmt, ...);
+u32 freeLoopCounters(void);
+int beginProgram(void);
+int endProgram(const char *const name);
+
+int assemblePrograms(const char *const inFiles[], u32 numFiles, const AsmOpts &opts, std::vector<Program> &progs,
+                     std::vector<EventSymbol> &eventSyms);
+int writeBinary(const std::vector<Program> &progs, const char *const outFile);
+int dma330as(const char *const inFiles[], u32 numFiles, const char *const outFile, const AsmOpts &opts);
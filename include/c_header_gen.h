@@ -1,7 +1,9 @@
 #pragma once
 
+#include <vector>
 #include "types.h"
+#include "program.h"
 
 
 
-int makeCHeader(const u8 *const buf, u32 size, const char *const path);
+int makeCHeader(const std::vector<Program> &progs, const std::vector<EventSymbol> &eventSyms, const char *const path);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "program.h"
+
+
+#define MAX_CHANNELS         (8u)
+#define MFIFO_DEFAULT_BYTES  (512u)
+
+
+typedef struct
+{
+	std::string prog; // Channel program name.
+	u32 minShare;     // Minimum share of AXI beats in percent. 0 = none.
+	u32 maxWait;      // Maximum cycles from burst issue to its first beat. 0 = none.
+} ChannelTarget;
+
+typedef struct
+{
+	bool print;                         // Print the model of all channels.
+	u32 mfifoBytes;                     // Shared MFIFO size. 0 = MFIFO_DEFAULT_BYTES.
+	std::vector<ChannelTarget> targets;
+} ContentionOpts;
+
+
+
+bool parseChannelTarget(const char *const str, std::vector<ChannelTarget> &targets);
+int checkContention(const std::vector<Program> &progs, const ContentionOpts &opts);
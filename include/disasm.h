@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include "types.h"
+
+
+// Request type an instruction depends on (S/B suffixes).
+enum
+{
+	COND_NONE   = 0u,
+	COND_SINGLE = 1u,
+	COND_BURST  = 2u
+};
+
+typedef struct
+{
+	u8  op;     // Base opcode (INST_*) with all parameter bits cleared.
+	u8  size;   // Instruction size in bytes. 0 = invalid.
+	u8  cond;   // COND_*
+	u8  lc;     // Loop counter (DMALP/DMALPEND).
+	u8  num;    // Periphal, event or channel number.
+	bool nf;    // DMALPEND not forever.
+	u32 imm;    // DMAMOV/DMAGO/DMAADDH/DMAADNH immediate, DMALP iterations - 1
+	            // or DMALPEND backwards jump.
+	u8  flags;  // Remaining raw bits (WFP type, MOV rd, ADD ra, GO ns, WFE invalidate).
+} DecodedInst;
+
+
+
+bool decodeInst(const u8 *const buf, u32 size, u32 pos, DecodedInst &di);
+bool isTransferInst(const DecodedInst &di);
+std::string formatCcr(u32 ccr);
@@ -15,6 +15,7 @@ enum
 	ERR_FILE_CREATE    = 8u,
 	ERR_FILE_WRITE     = 9u,
 	ERR_OUT_OF_MEMORY  = 10u,
+	ERR_SOCKET         = 11u,
 
 	// Parser errors.
 	ERR_UNK_INSTRUCTION      = 20u,
@@ -24,7 +25,12 @@ enum
 	ERR_NOT_ENOUGH_LCs       = 24u, // Not enough loop counters.
 	ERR_LOOPS_TOO_DEEP       = 25u,
 	ERR_LOOP_WITHOUT_START   = 26u,
-	ERR_LOOP_WITHOUT_END     = 27u
+	ERR_LOOP_WITHOUT_END     = 27u,
+	ERR_OUT_OF_EVENTS        = 28u,
+
+	// Analysis errors.
+	ERR_LATENCY_BUDGET       = 40u,
+	ERR_EVENT_DEADLOCK       = 41u
 };
 
 
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <vector>
+#include "types.h"
+#include "program.h"
+
+
+
+int checkEvents(const std::vector<Program> &progs, const std::vector<EventSymbol> &syms);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "types.h"
+#include "program.h"
+
+
+typedef struct
+{
+	u32 maxInsts; // Budget in instructions. 0 = unlimited.
+	u32 maxBytes; // Budget in instruction bytes fetched. 0 = unlimited.
+	bool print;   // Print the bound for every wait instruction.
+} LatencyOpts;
+
+
+
+int checkLatency(const Program &prog, const LatencyOpts &opts);
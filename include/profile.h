@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+
+#define PROFILE_HOT_DIV   (16u)  // Hot lines run at least 1/16 as often as the hottest.
+#define PROFILE_COLD_DIV  (256u) // Cold lines run at most 1/256 as often as the hottest.
+
+
+
+int loadProfile(const char *const path);
+bool profileLoaded(void);
+bool profileHot(const char *const srcFile, u32 line);
+bool profileCold(const char *const srcFile, u32 line);
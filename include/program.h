@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+
+
+typedef struct
+{
+	u32 pos;  // Bytecode offset of the first instruction of this line.
+	u32 line; // Source line.
+} LineMapEntry;
+
+// Symbolic event operand of a DMASEV/DMAWFE. Patched after allocation.
+struct EventRef
+{
+	u32 pos;
+	u32 line;
+	std::string name;
+};
+
+struct EventSymbol
+{
+	std::string name;
+	u8 num;
+};
+
+// An assembled channel program.
+struct Program
+{
+	std::string name;
+	std::string srcFile;
+	std::vector<u8> code;
+	std::vector<LineMapEntry> lineMap; // Sorted by pos.
+	std::vector<EventRef> eventRefs;
+
+	u32 lineAt(u32 pos) const;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "types.h"
+#include "asmparse.h"
+
+
+#define AXI_BUS_BYTES  (8u)  // AXI data bus width of the DMAC in bytes.
+#define MAX_BURST_LEN  (16u)
+
+
+
+int emitCopy2d(u32 argc, const char *const argv[MAX_TOKENS]);
+int emitZero(u32 argc, const char *const argv[MAX_TOKENS]);
+int emitFill(u32 argc, const char *const argv[MAX_TOKENS]);
+int emitPeriph(u32 argc, const char *const argv[MAX_TOKENS]);
+int dirPipeline(u32 argc, const char *const argv[MAX_TOKENS]);
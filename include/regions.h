@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+
+// Region types. The value is the fastest legal CCR SC/DC field.
+enum
+{
+	REGION_DEVICE    = 1u, // Bufferable.
+	REGION_NORMAL_NC = 3u, // Bufferable, modifiable.
+	REGION_NORMAL_WB = 7u  // Bufferable, modifiable, allocate.
+};
+
+
+
+int loadRegionMap(const char *const path);
+bool regionMapLoaded(void);
+s32 regionRangeCacheAttr(u32 first, u32 last);
+const char* regionTypeName(u32 type);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+#include "program.h"
+
+
+#define SIM_MAX_STEPS      (1u<<26)
+#define SIM_FOREVER_ITERS  (4u)     // Iterations of DMALPFE loops until the last request.
+
+
+typedef struct
+{
+	u64 insts;      // Executed instructions.
+	u64 fetchBytes; // Instruction bytes fetched.
+	u64 loadBytes;  // Data bytes read.
+	u64 storeBytes; // Data bytes written.
+	bool complete;  // Reached DMAEND or DMAKILL within SIM_MAX_STEPS.
+} ProgMetrics;
+
+
+
+ProgMetrics measureProgram(const Program &prog);
@@ -6,5 +6,6 @@
 
 const char* findChar(const char *str);
 s32 checkStrList(const char *const list[], u32 lSize, u32 cmpSize, const char *const str);
+bool parseNum(const char *const str, u32 &val);
 //const char* findWhitespace(const char *str);
 //void stripComment(char *line);
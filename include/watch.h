@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+#include "asmparse.h"
+
+
+#define WATCH_POLL_MS  (10)
+#define MAX_CLIENTS    (16u)
+
+
+
+int watchFiles(const char *const inFiles[], u32 numFiles, const char *const outFile, const AsmOpts &opts);
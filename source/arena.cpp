@@ -0,0 +1,72 @@
+#include <cstring>
+#include <algorithm>
+#include "types.h"
+#include "arena.h"
+#include "errors.h"
+
+
+
+int CodeArena::append(const void *const data, u32 size)
+{
+	if(size > ~used) return ERR_OUT_OF_RANGE;
+
+	const u8 *src = static_cast<const u8*>(data);
+	while(size > 0)
+	{
+		const u32 block = used / ARENA_BLOCK_SIZE;
+		if(block == blocks.size())
+		{
+			std::unique_ptr<u8[]> buf(new(std::nothrow) u8[ARENA_BLOCK_SIZE]);
+			if(!buf) return ERR_OUT_OF_MEMORY;
+			blocks.push_back(std::move(buf));
+		}
+
+		const u32 offset = used % ARENA_BLOCK_SIZE;
+		const u32 n = std::min(size, ARENA_BLOCK_SIZE - offset);
+		memcpy(&blocks[block][offset], src, n);
+		src += n;
+		used += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+// pos + size must not exceed the emitted code.
+void CodeArena::read(u32 pos, void *const out, u32 size) const
+{
+	u8 *dst = static_cast<u8*>(out);
+	while(size > 0)
+	{
+		const u32 offset = pos % ARENA_BLOCK_SIZE;
+		const u32 n = std::min(size, ARENA_BLOCK_SIZE - offset);
+		memcpy(dst, &blocks[pos / ARENA_BLOCK_SIZE][offset], n);
+		dst += n;
+		pos += n;
+		size -= n;
+	}
+}
+
+// Patches already emitted code.
+void CodeArena::write(u32 pos, const void *const data, u32 size)
+{
+	const u8 *src = static_cast<const u8*>(data);
+	while(size > 0)
+	{
+		const u32 offset = pos % ARENA_BLOCK_SIZE;
+		const u32 n = std::min(size, ARENA_BLOCK_SIZE - offset);
+		memcpy(&blocks[pos / ARENA_BLOCK_SIZE][offset], src, n);
+		src += n;
+		pos += n;
+		size -= n;
+	}
+}
+
+void CodeArena::copyTo(std::vector<u8> &out) const
+{
+	out.resize(used);
+	for(u32 pos = 0; pos < used; pos += ARENA_BLOCK_SIZE)
+	{
+		memcpy(&out[pos], blocks[pos / ARENA_BLOCK_SIZE].get(), std::min(used - pos, ARENA_BLOCK_SIZE));
+	}
+}
@@ -1,21 +1,53 @@
 #include <cstdio>
 #include <cstring>
+#include <cstdarg>
+#include <cctype>
 #include <string>
 #include <memory>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
+#include <thread>
+#include <exception>
+#include <chrono>
+#include <sys/resource.h>
+#include <poll.h>
 #include "types.h"
 #include "asmparse.h"
 #include "instructions.h"
 #include "utils.h"
 #include "c_header_gen.h"
 #include "errors.h"
+#include "program.h"
+#include "latency.h"
+#include "evgraph.h"
+#include "disasm.h"
+#include "pseudo.h"
+#include "regions.h"
+#include "arena.h"
+#include "sim.h"
+#include "profile.h"
+#include "contention.h"
+
+
+#define PAR_MIN_LINES     (16384u) // Minimum lines per chunk for parallel assembly.
+#define CACHE_BLOCK_MIN   (16u)    // Minimum lines per cached block.
+#define CACHE_BLOCK_MAX   (1024u)
+#define CACHE_CUT_MASK    (63u)    // Blocks end after about 1 in 64 lines.
+#define UNROLL_MAX        (8u)     // Maximum unroll factor of hot loops.
+#define UNROLL_MAX_BYTES  (128u)   // Maximum unrolled loop body size.
+#define ICACHE_LINE_BYTES (32u)    // Hot loop heads are aligned to this.
+#define REROLL_MAX_PERIOD (4u)     // Maximum instructions per re-rolled cold run iteration.
+#define CCR_INST_SIZE     (6u)     // DMAMOV CCR size in bytes.
 
 
 static const std::unordered_map<std::string, int (*)(u32, const char *const [MAX_TOKENS])> instMap
 ({
 	{"ADDH",   emitAdd},
 	{"ADNH",   emitAdd},
+	{"COPY2D", emitCopy2d}, // Pseudo instruction
 	{"END",    emitEnd},
+	{"FILL",   emitFill},   // Pseudo instruction
 	{"FLUSHP", emitFlushp},
 	{"GO",     emitGo},
 	{"KILL",   emitKill},
@@ -26,6 +58,7 @@ static const std::unordered_map<std::string, int (*)(u32, const char *const [MAX
 	{"LPFE",   emitLp}, // LPEND with special bits
 	{"MOV",    emitMov},
 	{"NOP",    emitNop},
+	{"PERIPH_RX", emitPeriph}, {"PERIPH_TX", emitPeriph}, // Pseudo instructions
 	{"RMB",    emitMb},
 	{"SEV",    emitSev},
 	{"ST",     emitSt},     {"STS",    emitSt}, {"STB",    emitSt},
@@ -33,14 +66,265 @@ static const std::unordered_map<std::string, int (*)(u32, const char *const [MAX
 	{"STZ",    emitSt},
 	{"WFE",    emitWfe},
 	{"WFP",    emitWfp},
-	{"WMB",    emitMb}
+	{"WMB",    emitMb},
+	{"ZERO",   emitZero}    // Pseudo instruction
 });
 
-static std::unique_ptr<u8[]> g_progBuf(nullptr);
-static u32 g_progPos = 0;
-static u32 g_loopDepth = 0;
+static const std::unordered_map<std::string, int (*)(u32, const char *const [MAX_TOKENS])> dirMap
+({
+	{".pipeline", dirPipeline}
+});
+
+// Emitter state is per thread. Chunks of a file are assembled in parallel.
+static thread_local CodeArena g_code{};
+static thread_local u32 g_loopDepth = 0;
+// We allow 1 loop forever and 2 counted loops.
+static thread_local u8 g_countedLoops = 0;
+static thread_local u8 g_loopTypes[3] = {0};   // 1 = DMALP, 2 = DMALPFE
+static thread_local u32 g_loopStarts[3] = {0}; // Each entry contains the start position.
+static thread_local u32 g_loopIters[3] = {0};  // Iterations. 0 = DMALPFE.
+static thread_local u32 g_curLine = 0;
+static thread_local std::vector<LineMapEntry> g_lineMap;
+static thread_local std::vector<EventRef> g_eventRefs;
+static thread_local std::vector<Program> g_newProgs; // Programs generated by directives.
+static thread_local const char *g_srcFile = nullptr;
+static bool g_verbose = false;
+
+// Known register values for picking cache attributes from the region map.
+typedef struct
+{
+	bool sarKnown;
+	bool darKnown;
+	bool ccrValid;
+	u8   ccrExplicit; // Bit 0 SC, bit 1 DC given in the source or already warned about.
+	u8   srcAttr;     // Chosen SC/DC field. 0xFF = none yet.
+	u8   dstAttr;
+	u32  sar;
+	u32  dar;
+	u32  ccrPos;      // Position of the last DMAMOV CCR.
+} RegTracking;
+
+static thread_local RegTracking g_regs{};
+
+// Addresses a transfer or loop touched. first > last = none.
+typedef struct
+{
+	s64 first;
+	s64 last;
+} AddrSpan;
+
+// DMANOPs aligning hot loops inside still open loops.
+typedef struct
+{
+	u32 pos;
+	u32 count;
+} NopPad;
+
+static thread_local std::vector<NopPad> g_alignPads;
+
+// Tracked registers at each loop start and the addresses its first pass touched.
+static thread_local RegTracking g_loopRegs[3];
+static thread_local AddrSpan g_loopSpans[3][2]; // SAR, DAR.
+static thread_local u8 g_loopMovs[3] = {0};     // Bit 0 SAR, bit 1 DAR set by DMAMOV inside the loop.
+
+// Emitter state of the file being assembled while a directive generates another program.
+static thread_local struct
+{
+	CodeArena code;
+	std::vector<LineMapEntry> lineMap;
+	std::vector<EventRef> eventRefs;
+	RegTracking regs;
+} g_savedProg;
+
+typedef struct
+{
+	u32 count;
+	u32 bytes; // Including programs generated by directives.
+} MnemonicStats;
+
+// Collected with --stats. Times of the assembler threads are summed.
+typedef struct
+{
+	u32 lines;
+	double readMs;
+	double lexMs;
+	double encodeMs;
+	double analysisMs;
+	std::unordered_map<std::string, MnemonicStats> mnemonics;
+} AsmStats;
+
+// Changes made because of the --profile counts.
+typedef struct
+{
+	u32 unrolled;
+	u32 aligned;
+	u32 rerolled;
+} ProfileStats;
 
+static thread_local ProfileStats g_profileStats{};
+
+// Part of a source file assembled on its own thread.
+typedef struct
+{
+	const char *srcFile;
+	const char *start; // First line of the chunk in the source.
+	const char *end;
+	u32 firstLine;     // Line number of the first line - 1.
+	u32 numLines;
+	int res;
+	u32 errLine;
+	u32 loopDepth;     // Open loops at the end of the chunk.
+	Program prog;
+	std::vector<Program> newProgs;
+	std::exception_ptr exception;
+	AsmStats stats;
+	ProfileStats profileStats;
+} Chunk;
+
+// Assembled blocks of a file keyed by their source text.
+typedef std::unordered_map<std::string, Chunk> ChunkCache;
+
+static std::unordered_map<std::string, ChunkCache> g_chunkCache; // Per source file.
+static bool g_statsEnabled = false;
+static AsmStats g_stats;
+
+
+
+// Users write DC as AWCACHE[3:0] with bit 2 unused.
+static u32 cacheFieldToUser(u32 field, bool write)
+{
+	return (write ? (field & 3u) | (field & 4u)<<1 : field);
+}
+
+// Restricts the cache attributes of the last DMAMOV CCR to legal ones for
+// the memory at addr. If a CCR is used for multiple regions it gets the
+// attributes legal for all of them. Explicit SC/DC are only checked.
+static void restrictCacheAttr(bool write, s32 legal, u32 addr, bool known)
+{
+	if(legal < 0) return;
+
+	u32 ccr;
+	g_code.read(g_regs.ccrPos + 2, &ccr, 4);
+	const u32 shift = (write ? CCR_DST_CACHE_CTRL_SHIFT : CCR_SRC_CACHE_CTRL_SHIFT);
+	const u32 cur = ccr>>shift & 7u;
+
+	const u8 explicitBit = (write ? 2u : 1u);
+	if(g_regs.ccrExplicit & explicitBit)
+	{
+		if(!known || g_regs.ccrExplicit & explicitBit<<2) return; // No address or warned already.
+
+		const char *const field = (write ? "DC" : "SC");
+		if(cur & ~legal)
+		{
+			fprintf(stderr, "Warning: Line %" PRIu32 ": %s%" PRIu32 " is not legal for %s memory at 0x%08" PRIX32
+			        " (%s%" PRIu32 ").\n", g_curLine, field, cacheFieldToUser(cur, write), regionTypeName(legal),
+			        addr, field, cacheFieldToUser(legal, write));
+		}
+		else if(cur != static_cast<u32>(legal))
+		{
+			fprintf(stderr, "Warning: Line %" PRIu32 ": %s%" PRIu32 " is slower than allowed for %s memory at 0x%08"
+			        PRIX32 " (%s%" PRIu32 ").\n", g_curLine, field, cacheFieldToUser(cur, write), regionTypeName(legal),
+			        addr, field, cacheFieldToUser(legal, write));
+		}
+		g_regs.ccrExplicit |= explicitBit<<2;
+		return;
+	}
+
+	u8 &attr = (write ? g_regs.dstAttr : g_regs.srcAttr);
+	attr = (attr == 0xFF ? legal : attr & legal);
+	ccr = (ccr & ~(7u<<shift)) | static_cast<u32>(attr)<<shift;
+	g_code.write(g_regs.ccrPos + 2, &ccr, 4);
+}
+
+// Restricts the cache attributes to all regions overlapping first to last
+// and adds them to the spans of all open loops. Ranges outside the address
+// space get device attributes.
+static void restrictCacheRange(bool write, s64 first, s64 last)
+{
+	for(u32 i = 0; i < g_loopDepth; i++)
+	{
+		AddrSpan &span = g_loopSpans[i][write];
+		span.first = std::min(span.first, first);
+		span.last = std::max(span.last, last);
+	}
+
+	if(first < 0 || last > 0xFFFFFFFF) restrictCacheAttr(write, REGION_DEVICE, 0, false);
+	else restrictCacheAttr(write, regionRangeCacheAttr(first, last), first, true);
+}
+
+// Picks the fastest legal AXI cache attributes of the last DMAMOV CCR for
+// the burst a load (SAR) or store (DAR) transfers and moves the tracked
+// address past it. Transfers from unknown addresses get device attributes.
+static void trackCacheAttr(bool write)
+{
+	if(!regionMapLoaded() || !g_regs.ccrValid) return;
+
+	u32 ccr;
+	g_code.read(g_regs.ccrPos + 2, &ccr, 4);
+	const bool inc = ccr>>(write ? CCR_DST_INC_SHIFT : CCR_SRC_INC_SHIFT) & 1u;
+	const u32 beat = 1u<<(ccr>>(write ? CCR_DST_BURST_SIZE_SHIFT : CCR_SRC_BURST_SIZE_SHIFT) & 7u);
+	const u32 burst = (ccr>>(write ? CCR_DST_BURST_LEN_SHIFT : CCR_SRC_BURST_LEN_SHIFT) & 15u) + 1;
+
+	u32 &addr = (write ? g_regs.dar : g_regs.sar);
+	if(!(write ? g_regs.darKnown : g_regs.sarKnown))
+	{
+		restrictCacheAttr(write, REGION_DEVICE, 0, false);
+		return;
+	}
+
+	const u32 bytes = (inc ? beat * burst : beat);
+	restrictCacheRange(write, addr, static_cast<s64>(addr) + bytes - 1);
+	if(inc) addr += bytes;
+}
+
+static void beginLoopTracking(void)
+{
+	g_loopRegs[g_loopDepth] = g_regs;
+	g_loopMovs[g_loopDepth] = 0;
+	for(AddrSpan &span : g_loopSpans[g_loopDepth]) span = AddrSpan{INT64_MAX, INT64_MIN};
+}
+
+// Checks the addresses the remaining iterations of the loop at depth touch
+// and moves SAR and DAR to where the loop leaves them. Called after closing
+// the loop so the swept span is added to the enclosing loops. Each pass touches the
+// span of the first pass moved by the address step per pass. Addresses
+// moved by DMALPFE loops become unknown.
+static void endLoopTracking(u32 depth)
+{
+	const RegTracking &start = g_loopRegs[depth];
+	const u32 iters = g_loopIters[depth];
+	for(u32 write = 0; write < 2; write++)
+	{
+		bool &known = (write ? g_regs.darKnown : g_regs.sarKnown);
+		u32 &addr = (write ? g_regs.dar : g_regs.sar);
+		const u32 first = (write ? start.dar : start.sar);
+		if(!known || !(write ? start.darKnown : start.sarKnown) || g_loopMovs[depth] & (1u<<write)) continue;
+
+		const s64 step = static_cast<s32>(addr - first);
+		if(step == 0) continue;
+		if(iters == 0)
+		{
+			known = false;
+			continue;
+		}
+
+		const AddrSpan span = g_loopSpans[depth][write];
+		const s64 moved = step * (iters - 1);
+		if(span.first <= span.last && regionMapLoaded() && g_regs.ccrValid)
+			restrictCacheRange(write, span.first + std::min<s64>(moved, 0), span.last + std::max<s64>(moved, 0));
+		addr = first + step * iters;
+	}
+}
+
+static int emitBytes(const void *const data, u32 size)
+{
+	return g_code.append(data, size);
+}
 
+static int emitByte(u8 val)
+{
+	return g_code.append(&val, 1);
+}
 
 int emitAdd(u32 argc, const char *const argv[MAX_TOKENS])
 {
@@ -57,22 +341,23 @@ int emitAdd(u32 argc, const char *const argv[MAX_TOKENS])
 	// SAR is 0. Nothing to do.
 	if(ra == 1) inst |= INST_BIT_ADD_DAR;
 
-	// TODO: Range check.
-	inst |= (strtoul(argv[2], nullptr, 0) & 0xFFFFu)<<INST_ADD_IMM_SHIFT;
+	u32 imm;
+	if(!parseNum(argv[2], imm)) return ERR_INV_PARSER_ARGS;
+	if(imm > 0xFFFFu) return ERR_OUT_OF_RANGE;
+	inst |= imm<<INST_ADD_IMM_SHIFT;
 
-	memcpy(&g_progBuf[g_progPos], &inst, 3);
-	g_progPos += 3;
+	const u32 delta = (argv[0][2] == 'D' ? imm : imm - 0x10000u); // ADNH adds 0xFFFF0000 | imm.
+	if(ra == 1) g_regs.dar += delta;
+	else        g_regs.sar += delta;
 
-	return 0;
+	return emitBytes(&inst, 3);
 }
 
 int emitEnd(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc != 1) return ERR_INV_PARSER_ARGS;
 
-	g_progBuf[g_progPos++] = INST_END;
-
-	return 0;
+	return emitByte(INST_END);
 }
 
 int emitFlushp(u32 argc, const char *const argv[MAX_TOKENS])
@@ -84,10 +369,7 @@ int emitFlushp(u32 argc, const char *const argv[MAX_TOKENS])
 	u16 inst = INST_FLUSHP;
 	inst |= (strtoul(argv[1], nullptr, 0) & INST_PERIPH_MASK)<<INST_PERIPH_SHIFT;
 
-	memcpy(&g_progBuf[g_progPos], &inst, 2);
-	g_progPos += 2;
-
-	return 0;
+	return emitBytes(&inst, 2);
 }
 
 int emitGo(u32 argc, const char *const argv[MAX_TOKENS])
@@ -108,19 +390,14 @@ int emitGo(u32 argc, const char *const argv[MAX_TOKENS])
 	inst |= (strtoul(argv[1], nullptr, 0) & INST_GO_CN_MASK)<<INST_GO_CN_SHIFT;
 	inst |= static_cast<u64>(strtoul(argv[2], nullptr, 0))<<INST_GO_IMM_SHIFT;
 
-	memcpy(&g_progBuf[g_progPos], &inst, 6);
-	g_progPos += 6;
-
-	return 0;
+	return emitBytes(&inst, 6);
 }
 
 int emitKill(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc != 1) return ERR_INV_PARSER_ARGS;
 
-	g_progBuf[g_progPos++] = INST_KILL;
-
-	return 0;
+	return emitByte(INST_KILL);
 }
 
 int emitLd(u32 argc, const char *const argv[MAX_TOKENS])
@@ -135,29 +412,57 @@ int emitLd(u32 argc, const char *const argv[MAX_TOKENS])
 	if(bs == 'B')      inst |= INST_BIT_BURST | INST_BIT_COND;
 	else if(bs == 'S') inst |= INST_BIT_COND;
 
+	trackCacheAttr(false);
+
 	if(inst & 1u<<5) // LDP
 	{
 		// TODO: Range check.
 		// TODO: Periphal numbers start with "P".
 		inst |= (strtoul(argv[1], nullptr, 0) & INST_PERIPH_MASK)<<INST_PERIPH_SHIFT;
 
-		memcpy(&g_progBuf[g_progPos], &inst, 2);
-		g_progPos += 2;
+		return emitBytes(&inst, 2);
 	}
-	else g_progBuf[g_progPos++] = static_cast<u8>(inst);
 
-	return 0;
+	return emitByte(static_cast<u8>(inst));
+}
+
+// Removes hot loop alignment DMANOPs behind start until the DMALPEND
+// of the loop at start reaches it. Closed loops around a pad get their
+// backward jump shortened.
+static void removeAlignPads(u32 start)
+{
+	while(!g_alignPads.empty() && g_alignPads.back().pos >= start && g_code.size() - start > 255)
+	{
+		const NopPad pad = g_alignPads.back();
+		g_alignPads.pop_back();
+
+		const u32 size = g_code.size();
+		std::vector<u8> code(size);
+		g_code.read(0, code.data(), size);
+		DecodedInst di;
+		for(u32 pos = pad.pos + pad.count; decodeInst(code.data(), size, pos, di); pos += di.size)
+		{
+			if(di.op == INST_LPEND && pos - di.imm <= pad.pos) code[pos + 1] -= pad.count;
+		}
+		code.erase(code.begin() + pad.pos, code.begin() + pad.pos + pad.count);
+		g_code.write(0, code.data(), code.size());
+		g_code.truncate(code.size());
+
+		for(LineMapEntry &entry : g_lineMap) if(entry.pos > pad.pos) entry.pos -= std::min(entry.pos - pad.pos, pad.count);
+		for(EventRef &ref : g_eventRefs) if(ref.pos >= pad.pos + pad.count) ref.pos -= pad.count;
+		if(g_regs.ccrValid && g_regs.ccrPos >= pad.pos + pad.count) g_regs.ccrPos -= pad.count;
+		for(u32 i = 0; i < g_loopDepth; i++) if(g_loopStarts[i] >= pad.pos + pad.count) g_loopStarts[i] -= pad.count;
+		g_profileStats.aligned--;
+
+		fprintf(stderr, "Warning: Line %" PRIu32 ": Hot loop alignment removed. The enclosing loop got too long.\n",
+		        g_curLine);
+	}
 }
 
 int emitLp(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc < 1 || argc > 2) return ERR_INV_PARSER_ARGS;
 
-	// We allow 1 loop forever and 2 counted loops.
-	static u8 countedLoops = 0;
-	static u8 lTypes[3] = {0};   // 1 = DMALP, 2 = DMALPFE
-	static u32 lStarts[3] = {0}; // Each entry contains the start position.
-
 	if(strcmp("LPFE", argv[0]) != 0) // Not DMALPFE.
 	{
 		u16 inst;
@@ -165,14 +470,17 @@ int emitLp(u32 argc, const char *const argv[MAX_TOKENS])
 		{
 			if(argc != 2) return ERR_INV_PARSER_ARGS;
 			if(g_loopDepth == 3) return ERR_LOOPS_TOO_DEEP;
-			if(countedLoops == 2) return ERR_NOT_ENOUGH_LCs;
+			if(g_countedLoops == 2) return ERR_NOT_ENOUGH_LCs;
 
-			countedLoops++;
-			lTypes[g_loopDepth] = 1;
-			lStarts[g_loopDepth++] = g_progPos + 2;
+			g_countedLoops++;
+			const u32 iters = strtoul(argv[1], nullptr, 0);
+			beginLoopTracking();
+			g_loopTypes[g_loopDepth] = 1;
+			g_loopIters[g_loopDepth] = iters;
+			g_loopStarts[g_loopDepth++] = g_code.size() + 2;
 
-			inst = INST_LP | (countedLoops == 2 ? INST_BIT_LP_LC1 : 0u);
-			inst |= (strtoul(argv[1], nullptr, 0) - 1)<<INST_LP_ITER_SHIFT; // TODO: Error and range checking.
+			inst = INST_LP | (g_countedLoops == 2 ? INST_BIT_LP_LC1 : 0u);
+			inst |= (iters - 1)<<INST_LP_ITER_SHIFT; // TODO: Error and range checking.
 		}
 		else // DMALPEND
 		{
@@ -181,13 +489,13 @@ int emitLp(u32 argc, const char *const argv[MAX_TOKENS])
 
 			const char bs = argv[0][strlen(argv[0]) - 1];
 			inst = INST_LPEND;
-			if(lTypes[g_loopDepth - 1] == 1) // DMALP
+			if(g_loopTypes[g_loopDepth - 1] == 1) // DMALP
 			{
 				if(bs == 'B')      inst |= INST_BIT_BURST | INST_BIT_COND;
 				else if(bs == 'S') inst |= INST_BIT_COND;
-				inst |= INST_BIT_LPEND_NOT_FOREVER | (countedLoops == 2 ? INST_BIT_LPEND_LC1 : 0u);
+				inst |= INST_BIT_LPEND_NOT_FOREVER | (g_countedLoops == 2 ? INST_BIT_LPEND_LC1 : 0u);
 
-				countedLoops--;
+				g_countedLoops--;
 			}
 			else // DMALPFE
 			{
@@ -198,24 +506,29 @@ int emitLp(u32 argc, const char *const argv[MAX_TOKENS])
 				}
 			}
 
-			const u32 back_jmp = g_progPos - lStarts[g_loopDepth - 1];
-			if(back_jmp > 255 || back_jmp > ~g_progPos) return ERR_OUT_OF_RANGE;
+			removeAlignPads(g_loopStarts[g_loopDepth - 1]);
+			const u32 back_jmp = g_code.size() - g_loopStarts[g_loopDepth - 1];
+			if(back_jmp > 255 || back_jmp > ~g_code.size()) return ERR_OUT_OF_RANGE;
 			inst |= back_jmp<<INST_LPEND_BACK_JMP_SHIFT;
 
 			g_loopDepth--;
+			endLoopTracking(g_loopDepth);
+			if(g_loopDepth == 0) g_alignPads.clear();
 		}
 
-		memcpy(&g_progBuf[g_progPos], &inst, 2);
-		g_progPos += 2;
+		const int res = emitBytes(&inst, 2);
+		if(res != 0) return res;
 	}
 	else // Handle DMALPFE pseudo instruction.
 	{
 		if(argc != 1) return ERR_INV_PARSER_ARGS;
 		if(g_loopDepth == 3) return ERR_LOOPS_TOO_DEEP;
-		if(lTypes[0] == 2 || lTypes[1] == 2 || lTypes[2] == 2) return ERR_LOOPS_TOO_DEEP;
+		for(u32 i = 0; i < g_loopDepth; i++) if(g_loopTypes[i] == 2) return ERR_LOOPS_TOO_DEEP;
 
-		lTypes[g_loopDepth] = 2;
-		lStarts[g_loopDepth++] = g_progPos;
+		beginLoopTracking();
+		g_loopTypes[g_loopDepth] = 2;
+		g_loopIters[g_loopDepth] = 0;
+		g_loopStarts[g_loopDepth++] = g_code.size();
 	}
 
 	return 0;
@@ -228,7 +541,9 @@ int emitMov(u32 argc, const char *const argv[MAX_TOKENS])
 	static const char *const regWlist[3] = {"SAR", "CCR", "DAR"};
 	s32 rd;
 	if((rd = checkStrList(regWlist, 3, 0, argv[1])) < 0) return ERR_UNK_REGISTER;
-	if(rd != 1 && argc > 3) return ERR_INV_PARSER_ARGS;
+	u32 imm = 0;
+	const bool isImm = (argc == 3 && parseNum(argv[2], imm));
+	if(rd != 1 && !isImm) return ERR_INV_PARSER_ARGS;
 
 	// Defaults.
 	u64 inst = INST_MOV;
@@ -238,9 +553,11 @@ int emitMov(u32 argc, const char *const argv[MAX_TOKENS])
 	//else if(rd == 2) inst |= 2u<<INST_MOV_RD_SHIFT; // DAR
 	inst |= static_cast<u32>(rd)<<INST_MOV_RD_SHIFT;
 
-	if(argc == 3) inst |= static_cast<u64>(strtoul(argv[2], nullptr, 0))<<INST_MOV_IMM_SHIFT; // TODO: Error checking.
+	u8 ccrExplicit = 3; // Raw CCR values set SC and DC explicitly.
+	if(isImm) inst |= static_cast<u64>(imm)<<INST_MOV_IMM_SHIFT;
 	else
 	{
+		ccrExplicit = 0;
 		inst |= CCR_DEFAULT_VAL<<INST_MOV_IMM_SHIFT;
 
 		for(u32 i = 2; i < argc; i++)
@@ -250,6 +567,8 @@ int emitMov(u32 argc, const char *const argv[MAX_TOKENS])
 			static const char *const ccrWlist[11] = {"SA", "SB", "SS", "SP", "SC", "DA", "DB", "DS", "DP", "DC", "ES"};
 			s32 ccrArg;
 			if((ccrArg = checkStrList(ccrWlist, 11, 2, arg)) < 0) return ERR_INV_PARSER_ARGS;
+			if(ccrArg == 4)      ccrExplicit |= 1u;
+			else if(ccrArg == 9) ccrExplicit |= 2u;
 
 			static const struct
 			{
@@ -324,26 +643,69 @@ int emitMov(u32 argc, const char *const argv[MAX_TOKENS])
 		}
 	}
 
-	memcpy(&g_progBuf[g_progPos], &inst, 6);
-	g_progPos += 6;
+	switch(rd)
+	{
+		case 0: // SAR
+			for(u32 i = 0; i < g_loopDepth; i++) g_loopMovs[i] |= 1u;
+			g_regs.sarKnown = true;
+			g_regs.sar = imm;
+			break;
+		case 1: // CCR
+			g_regs.ccrValid = true;
+			g_regs.ccrExplicit = ccrExplicit;
+			g_regs.srcAttr = g_regs.dstAttr = 0xFF;
+			g_regs.ccrPos = g_code.size();
+			break;
+		case 2: // DAR
+			for(u32 i = 0; i < g_loopDepth; i++) g_loopMovs[i] |= 2u;
+			g_regs.darKnown = true;
+			g_regs.dar = imm;
+			break;
+	}
 
-	return 0;
+	return emitBytes(&inst, 6);
 }
 
 int emitNop(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc != 1) return ERR_INV_PARSER_ARGS;
 
-	g_progBuf[g_progPos++] = INST_NOP;
-
-	return 0;
+	return emitByte(INST_NOP);
 }
 
 int emitMb(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc != 1) return ERR_INV_PARSER_ARGS;
 
-	g_progBuf[g_progPos++] = (argv[0][0] == 'R' ? INST_RMB : INST_WMB);
+	return emitByte((argv[0][0] == 'R' ? INST_RMB : INST_WMB));
+}
+
+// Event numbers are either numeric (optionally prefixed with "E") or
+// symbols which get an event number allocated after assembly.
+static int parseEvent(const char *const arg, u16 &inst)
+{
+	const char *num = arg;
+	if(*num == 'E' && num[1] >= '0' && num[1] <= '9') num++;
+
+	if(*num >= '0' && *num <= '9')
+	{
+		char *end;
+		const unsigned long event = strtoul(num, &end, 0);
+		if(*end != '\0') return ERR_INV_PARSER_ARGS;
+		if(event > INST_EVENT_MASK) return ERR_OUT_OF_RANGE;
+
+		inst |= event<<INST_EVENT_SHIFT;
+	}
+	else
+	{
+		if(!isalpha(static_cast<unsigned char>(*arg)) && *arg != '_') return ERR_INV_PARSER_ARGS;
+		for(const char *c = arg; *c != '\0'; c++)
+		{
+			if(!isalnum(static_cast<unsigned char>(*c)) && *c != '_') return ERR_INV_PARSER_ARGS;
+		}
+
+		g_eventRefs.push_back({g_code.size(), g_curLine, arg});
+	}
 
 	return 0;
 }
@@ -352,15 +714,11 @@ int emitSev(u32 argc, const char *const argv[MAX_TOKENS])
 {
 	if(argc != 2) return ERR_INV_PARSER_ARGS;
 
-	// TODO: Range check.
-	// TODO: Event numbers start with "E"?
 	u16 inst = INST_SEV;
-	inst |= (strtoul(argv[1], nullptr, 0) & INST_EVENT_MASK)<<INST_EVENT_SHIFT;
+	const int res = parseEvent(argv[1], inst);
+	if(res != 0) return res;
 
-	memcpy(&g_progBuf[g_progPos], &inst, 2);
-	g_progPos += 2;
-
-	return 0;
+	return emitBytes(&inst, 2);
 }
 
 int emitSt(u32 argc, const char *const argv[MAX_TOKENS])
@@ -379,18 +737,18 @@ int emitSt(u32 argc, const char *const argv[MAX_TOKENS])
 		else if(bs == 'S') inst |= INST_BIT_COND;
 	}
 
+	trackCacheAttr(true);
+
 	if(inst & 1u<<5) // STP
 	{
 		// TODO: Range check.
 		// TODO: Periphal numbers start with "P".
 		inst |= (strtoul(argv[1], nullptr, 0) & INST_PERIPH_MASK)<<INST_PERIPH_SHIFT;
 
-		memcpy(&g_progBuf[g_progPos], &inst, 2);
-		g_progPos += 2;
+		return emitBytes(&inst, 2);
 	}
-	else g_progBuf[g_progPos++] = static_cast<u8>(inst);
 
-	return 0;
+	return emitByte(static_cast<u8>(inst));
 }
 
 int emitWfe(u32 argc, const char *const argv[MAX_TOKENS])
@@ -404,14 +762,10 @@ int emitWfe(u32 argc, const char *const argv[MAX_TOKENS])
 		else return ERR_INV_PARSER_ARGS;
 	}
 
-	// TODO: Range check.
-	// TODO: Event numbers start with "E"?
-	inst |= (strtoul(argv[1], nullptr, 0) & INST_EVENT_MASK)<<INST_EVENT_SHIFT;
-
-	memcpy(&g_progBuf[g_progPos], &inst, 2);
-	g_progPos += 2;
+	const int res = parseEvent(argv[1], inst);
+	if(res != 0) return res;
 
-	return 0;
+	return emitBytes(&inst, 2);
 }
 
 int emitWfp(u32 argc, const char *const argv[MAX_TOKENS])
@@ -428,87 +782,897 @@ int emitWfp(u32 argc, const char *const argv[MAX_TOKENS])
 
 	inst |= (strtoul(argv[1], nullptr, 0) & INST_PERIPH_MASK)<<INST_PERIPH_SHIFT;
 
-	memcpy(&g_progBuf[g_progPos], &inst, 2);
-	g_progPos += 2;
-
-	return 0;
+	return emitBytes(&inst, 2);
 }
 
 // Assumes at least 1 token.
 static u32 tokenize(char *const line, const char *tokens[MAX_TOKENS])
 {
 	memset(tokens, 0, sizeof(char*) * MAX_TOKENS);
-	tokens[0] = strtok(line, " ,\t");
+	char *save;
+	tokens[0] = strtok_r(line, " ,\t", &save);
 	u32 num = 1;
 	for(u32 i = 1; i < MAX_TOKENS; i++)
 	{
-		if((tokens[i] = strtok(nullptr, " ,\t")) == nullptr) break;
+		if((tokens[i] = strtok_r(nullptr, " ,\t", &save)) == nullptr) break;
 		num++;
 	}
 
 	return num;
 }
 
-int dma330as(const char *const inFile, const char *const outFile)
+// Assembles a single instruction for pseudo instructions and directives.
+int emitLine(const char *const fmt, ...)
+{
+	char line[INBUF_SIZE];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(line, INBUF_SIZE, fmt, args);
+	va_end(args);
+
+	const char *tokens[MAX_TOKENS];
+	const u32 num = tokenize(line, tokens);
+
+	const auto it = instMap.find(tokens[0]);
+	if(it == instMap.cend()) return ERR_UNK_INSTRUCTION;
+
+	return it->second(num, tokens);
+}
+
+u32 freeLoopCounters(void)
+{
+	return 2u - g_countedLoops;
+}
+
+// Starts a new channel program. The current one is continued after endProgram().
+int beginProgram(void)
+{
+	if(g_loopDepth != 0) return ERR_LOOPS_TOO_DEEP;
+
+	g_savedProg.code = std::move(g_code);
+	g_savedProg.lineMap = std::move(g_lineMap);
+	g_savedProg.eventRefs = std::move(g_eventRefs);
+	g_savedProg.regs = g_regs;
+
+	g_code = CodeArena{};
+	g_lineMap.assign(1, {0, g_curLine});
+	g_eventRefs.clear();
+	g_regs = RegTracking{};
+
+	return 0;
+}
+
+int endProgram(const char *const name)
+{
+	if(g_loopDepth != 0) return ERR_LOOP_WITHOUT_END;
+
+	Program prog;
+	prog.name = name;
+	g_code.copyTo(prog.code);
+	prog.lineMap = std::move(g_lineMap);
+	prog.eventRefs = std::move(g_eventRefs);
+	g_newProgs.push_back(std::move(prog));
+
+	g_code = std::move(g_savedProg.code);
+	g_lineMap = std::move(g_savedProg.lineMap);
+	g_eventRefs = std::move(g_savedProg.eventRefs);
+	g_regs = g_savedProg.regs;
+
+	return 0;
+}
+
+// End of the line starting at pos. Splits lines like fgets() with INBUF_SIZE.
+static const char* lineEnd(const char *pos, const char *const end)
+{
+	const char *const max = (end - pos > INBUF_SIZE - 1 ? pos + INBUF_SIZE - 1 : end);
+	const char *const nl = static_cast<const char*>(memchr(pos, '\n', max - pos));
+
+	return (nl ? nl + 1 : max);
+}
+
+// Loop nesting change of a source line without assembling it.
+// Matches what emitLp() does for lines which assemble without error.
+static s32 loopDepthDelta(const char *pos, const char *const end)
+{
+	while(pos < end && (*pos < '!' || *pos > '~')) pos++; // Like findChar().
+	if(end - pos >= 3 && strncmp(pos, "DMA", 3) == 0) pos += 3;
+
+	const char *mnemonic = pos;
+	while(pos < end && *pos != ' ' && *pos != ',' && *pos != '\t' && *pos != '#' && *pos != '\n') pos++;
+
+	static const char *const loopWlist[5] = {"LP", "LPFE", "LPEND", "LPENDS", "LPENDB"};
+	const u32 len = pos - mnemonic;
+	for(u32 i = 0; i < 5; i++)
+	{
+		if(strlen(loopWlist[i]) == len && strncmp(loopWlist[i], mnemonic, len) == 0) return (i < 2 ? 1 : -1);
+	}
+
+	return 0;
+}
+
+static Chunk makeChunk(const char *const start, const char *const end, u32 firstLine, u32 numLines)
+{
+	Chunk chunk{};
+	chunk.start = start;
+	chunk.end = end;
+	chunk.firstLine = firstLine;
+	chunk.numLines = numLines;
+
+	return chunk;
+}
+
+// Splits the source into up to jobs chunks of similar line count.
+// Chunks only end where no loop is open so each one assembles on its own.
+static std::vector<Chunk> splitChunks(const char *const src, const char *const end, u32 jobs)
+{
+	std::vector<const char*> lines;
+	for(const char *pos = src; pos < end; pos = lineEnd(pos, end)) lines.push_back(pos);
+
+	std::vector<Chunk> chunks;
+	const u32 numLines = lines.size();
+	if(jobs > numLines / PAR_MIN_LINES) jobs = numLines / PAR_MIN_LINES;
+	if(jobs < 2)
+	{
+		chunks.push_back(makeChunk(src, end, 0, numLines));
+		return chunks;
+	}
+
+	const u32 target = numLines / jobs;
+	u32 first = 0;
+	s32 depth = 0;
+	for(u32 i = 0; i < numLines; i++)
+	{
+		const char *const next = (i + 1 < numLines ? lines[i + 1] : end);
+		depth += loopDepthDelta(lines[i], next);
+		if(depth == 0 && i + 1 - first >= target && chunks.size() + 1 < jobs && i + 1 < numLines)
+		{
+			chunks.push_back(makeChunk(lines[first], next, first, i + 1 - first));
+			first = i + 1;
+		}
+	}
+	chunks.push_back(makeChunk(lines[first], end, first, numLines - first));
+
+	return chunks;
+}
+
+// Splits the source into small blocks for reuse after edits. Blocks end
+// where no loop is open and at lines picked by their content so block
+// boundaries after an edit are the same as before.
+static std::vector<Chunk> splitBlocks(const char *const src, const char *const end)
+{
+	std::vector<Chunk> blocks;
+	const char *blockStart = src;
+	u32 first = 0, line = 0;
+	s32 depth = 0;
+	for(const char *pos = src; pos < end; line++)
+	{
+		const char *const next = lineEnd(pos, end);
+		depth += loopDepthDelta(pos, next);
+
+		u32 hash = 2166136261u; // FNV-1a
+		for(const char *c = pos; c < next; c++) hash = (hash ^ static_cast<u8>(*c)) * 16777619u;
+		pos = next;
+
+		const u32 len = line + 1 - first;
+		if(depth == 0 && len >= CACHE_BLOCK_MIN && ((hash & CACHE_CUT_MASK) == 0 || len >= CACHE_BLOCK_MAX))
+		{
+			blocks.push_back(makeChunk(blockStart, next, first, len));
+			blockStart = next;
+			first = line + 1;
+		}
+	}
+	if(blockStart < end || blocks.empty()) blocks.push_back(makeChunk(blockStart, end, first, line - first));
+
+	return blocks;
+}
+
+// Moves all source line numbers of a reused block.
+static void shiftLines(Chunk &chunk, u32 firstLine)
+{
+	const u32 delta = firstLine - chunk.firstLine; // Wraps for negative.
+	auto shiftProg = [delta](Program &prog)
+	{
+		for(LineMapEntry &entry : prog.lineMap) entry.line += delta;
+		for(EventRef &ref : prog.eventRefs) ref.line += delta;
+	};
+
+	shiftProg(chunk.prog);
+	for(Program &newProg : chunk.newProgs) shiftProg(newProg);
+	chunk.errLine += delta;
+	chunk.firstLine = firstLine;
+}
+
+// Copies a source line to buf and strips whitespace, comments and the DMA
+// prefix. Returns nullptr for empty and comment lines.
+static char* cleanLine(const char *const pos, const char *const end, char *const buf)
+{
+	memcpy(buf, pos, end - pos);
+	buf[end - pos] = '\0';
+
+	char *line = const_cast<char*>(findChar(buf));
+	if(line == nullptr || *line == '#') return nullptr;
+	char *save;
+	strtok_r(line, "#\n", &save); // Remove comments and newlines.
+	if(strncmp("DMA", line, 3) == 0) line += 3;
+
+	return line;
+}
+
+static int assembleLine(const char *const pos, const char *const end, u32 curLine, AsmStats &stats)
+{
+	const auto lexStart = (g_statsEnabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{});
+	char inBuf[INBUF_SIZE];
+	char *const line = cleanLine(pos, end, inBuf);
+	if(line == nullptr) return 0;
+	if(g_verbose) printf("Line %u: %s\n", curLine, line);
+
+	const char *tokens[MAX_TOKENS];
+	const u32 num = tokenize(line, tokens);
+
+	g_curLine = curLine;
+	int (*emit)(u32, const char *const [MAX_TOKENS]);
+	if(*tokens[0] == '.')
+	{
+		const auto it = dirMap.find(tokens[0]);
+		if(it == dirMap.cend()) return ERR_UNK_INSTRUCTION;
+		emit = it->second;
+	}
+	else
+	{
+		const auto it = instMap.find(tokens[0]);
+		if(it == instMap.cend()) return ERR_UNK_INSTRUCTION;
+		emit = it->second;
+		g_lineMap.push_back({g_code.size(), curLine});
+	}
+
+	if(!g_statsEnabled) return emit(num, tokens);
+
+	const auto encodeStart = std::chrono::steady_clock::now();
+	const u32 size = g_code.size();
+	const u32 numNewProgs = g_newProgs.size();
+	const int res = emit(num, tokens);
+	stats.lexMs += std::chrono::duration<double, std::milli>(encodeStart - lexStart).count();
+	stats.encodeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+	if(res != 0) return res;
+
+	MnemonicStats &ms = stats.mnemonics[tokens[0]];
+	ms.count++;
+	ms.bytes += g_code.size() - size;
+	for(u32 i = numNewProgs; i < g_newProgs.size(); i++) ms.bytes += g_newProgs[i].code.size();
+
+	return 0;
+}
+
+// Inserts count DMANOPs at pos and moves everything behind it.
+static void insertNops(u32 pos, u32 count)
+{
+	for(NopPad &pad : g_alignPads) if(pad.pos >= pos) pad.pos += count;
+
+	std::vector<u8> tail(g_code.size() - pos);
+	g_code.read(pos, tail.data(), tail.size());
+	const std::vector<u8> nops(count, INST_NOP);
+	g_code.append(nops.data(), count);
+	g_code.write(pos, nops.data(), count);
+	g_code.write(pos + count, tail.data(), tail.size());
+
+	for(LineMapEntry &entry : g_lineMap) if(entry.pos >= pos) entry.pos += count;
+	for(EventRef &ref : g_eventRefs) if(ref.pos >= pos) ref.pos += count;
+	if(g_regs.ccrValid && g_regs.ccrPos >= pos) g_regs.ccrPos += count;
+}
+
+static bool isUnrollable(const char *const mnemonic)
+{
+	static const char *const unrollWlist[] = {"ADDH", "ADNH", "FLUSHP", "LD", "LDS", "LDB", "LDP", "LDPS", "LDPB", "MOV",
+	                                          "NOP", "RMB", "SEV", "ST", "STS", "STB", "STP", "STPS", "STPB", "STZ",
+	                                          "WFE", "WFP", "WMB"};
+	for(const char *const m : unrollWlist) if(strcmp(m, mnemonic) == 0) return true;
+
+	return false;
+}
+
+static int assembleLines(const char *pos, const char *const end, u32 &curLine, AsmStats &stats);
+
+// Assembles a hot loop from its DMALP/DMALPFE line at pos to the matching
+// DMALPEND line [endLine, endLineEnd). Innermost DMALP loops of simple
+// instructions are unrolled up to UNROLL_MAX times. Innermost loop heads are
+// aligned to an instruction cache line if the loop spans fewer lines then.
+static int assembleHotLoop(const char *const pos, const char *const endLine, const char *const endLineEnd,
+                           u32 &curLine, AsmStats &stats)
+{
+	const char *const bodyStart = lineEnd(pos, endLine);
+	const u32 headLine = ++curLine;
+	const u32 headPos = g_code.size();
+	int res = assembleLine(pos, bodyStart, headLine, stats);
+	if(res != 0) return res;
+
+	const u32 bodyPos = g_code.size();
+	if((res = assembleLines(bodyStart, endLine, curLine, stats)) != 0) return res;
+	const u32 lastBodyLine = curLine;
+
+	char inBuf[INBUF_SIZE];
+	const char *tokens[MAX_TOKENS];
+	bool innermost = true, simple = true;
+	for(const char *p = bodyStart; p < endLine; p = lineEnd(p, endLine))
+	{
+		char *const line = cleanLine(p, lineEnd(p, endLine), inBuf);
+		if(line == nullptr) continue;
+		tokenize(line, tokens);
+		innermost &= (strncmp(tokens[0], "LP", 2) != 0);
+		simple &= isUnrollable(tokens[0]);
+	}
+
+	// Unrolling needs a DMALP count and a plain DMALPEND.
+	const u32 num = tokenize(cleanLine(pos, bodyStart, inBuf), tokens);
+	const u32 iters = (strcmp(tokens[0], "LP") == 0 && num == 2 ? strtoul(tokens[1], nullptr, 0) : 0);
+	char *const end = cleanLine(endLine, endLineEnd, inBuf);
+	const bool plainEnd = (end && tokenize(end, tokens) == 1 && strcmp(tokens[0], "LPEND") == 0);
+
+	const u32 bodyBytes = g_code.size() - bodyPos;
+	u32 factor = UNROLL_MAX;
+	while(factor > 1 && (iters % factor != 0 || bodyBytes * factor > UNROLL_MAX_BYTES)) factor /= 2;
+	if(innermost && simple && plainEnd && iters >= 1 && iters <= 256 && bodyBytes && factor > 1)
+	{
+		const u8 itersField = iters / factor - 1;
+		g_code.write(headPos + 1, &itersField, 1);
+		g_loopIters[g_loopDepth - 1] = iters / factor;
+		for(u32 i = 1; i < factor; i++)
+		{
+			curLine = headLine;
+			if((res = assembleLines(bodyStart, endLine, curLine, stats)) != 0) return res;
+		}
+		g_profileStats.unrolled++;
+	}
+
+	curLine = lastBodyLine + 1;
+	if((res = assembleLine(endLine, endLineEnd, curLine, stats)) != 0) return res;
+
+	const u32 loopEnd = g_code.size();
+	const u32 pad = (ICACHE_LINE_BYTES - bodyPos % ICACHE_LINE_BYTES) % ICACHE_LINE_BYTES;
+	const u32 linesNow = (loopEnd - 1) / ICACHE_LINE_BYTES - bodyPos / ICACHE_LINE_BYTES + 1;
+	const u32 linesAligned = (loopEnd - bodyPos + ICACHE_LINE_BYTES - 1) / ICACHE_LINE_BYTES;
+	if(innermost && pad && linesAligned < linesNow)
+	{
+		// Enclosing loops must still reach their start with a DMALPEND.
+		bool fits = true;
+		for(u32 i = 0; i < g_loopDepth; i++) fits &= (g_code.size() + pad - g_loopStarts[i] <= 255);
+		if(fits)
+		{
+			insertNops(headPos, pad);
+			if(g_loopDepth > 0) g_alignPads.push_back({headPos, pad});
+			g_profileStats.aligned++;
+		}
+		else fprintf(stderr, "Warning: Line %" PRIu32 ": Hot loop not aligned. The enclosing loop would get too long.\n",
+		             headLine);
+	}
+
+	return 0;
+}
+
+// Size and condition of transfers which can be re-rolled.
+// Returns 0 for other instructions.
+static u32 rerollSize(const char *const mnemonic, char &cond)
+{
+	static const char *const rerollWlist[8] = {"LDS", "LDB", "STS", "STB", "LDPS", "LDPB", "STPS", "STPB"};
+	for(u32 i = 0; i < 8; i++)
+	{
+		if(strcmp(rerollWlist[i], mnemonic) == 0)
+		{
+			cond = mnemonic[strlen(mnemonic) - 1];
+			return (i < 4 ? 1 : 2);
+		}
+	}
+
+	return 0;
+}
+
+// Re-rolls a cold run of repeated conditional transfers starting at pos into
+// a DMALP loop with conditional DMALPEND. The loop executes as DMANOPs for
+// the other request type just like the transfers it replaces.
+// Returns false if there is no run which gets smaller.
+static bool rerollRun(const char *&pos, const char *const end, u32 &curLine, AsmStats &stats, int &res)
+{
+	if(freeLoopCounters() == 0 || g_loopDepth == 3) return false;
+
+	std::vector<std::string> sigs; // Normalized lines of the run.
+	std::vector<u32> sizes;
+	char runCond = 0;
+	char inBuf[INBUF_SIZE];
+	u32 line = curLine;
+	for(const char *p = pos; p < end && sigs.size() < REROLL_MAX_PERIOD * 256; p = lineEnd(p, end))
+	{
+		char *const text = cleanLine(p, lineEnd(p, end), inBuf);
+		if(text == nullptr || !profileCold(g_srcFile, ++line)) break;
+
+		const char *tokens[MAX_TOKENS];
+		const u32 num = tokenize(text, tokens);
+		char cond;
+		const u32 size = rerollSize(tokens[0], cond);
+		if(size == 0 || (runCond && cond != runCond)) break;
+		runCond = cond;
+
+		std::string sig;
+		for(u32 i = 0; i < num; i++) sig += std::string(i ? " " : "") + tokens[i];
+		sigs.push_back(std::move(sig));
+		sizes.push_back(size);
+	}
+
+	u32 bestPeriod = 0, bestReps = 0;
+	s32 bestSaved = 0;
+	for(u32 period = 1; period <= REROLL_MAX_PERIOD && period * 2 <= sigs.size(); period++)
+	{
+		u32 reps = 1;
+		while(reps < 256 && (reps + 1) * period <= sigs.size() &&
+		      std::equal(sigs.cbegin(), sigs.cbegin() + period, sigs.cbegin() + reps * period)) reps++;
+
+		u32 bodyBytes = 0;
+		for(u32 i = 0; i < period; i++) bodyBytes += sizes[i];
+		const s32 saved = static_cast<s32>((reps - 1) * bodyBytes) - 4; // DMALP + DMALPEND.
+		if(reps > 1 && saved > bestSaved)
+		{
+			bestPeriod = period;
+			bestReps = reps;
+			bestSaved = saved;
+		}
+	}
+	if(bestPeriod == 0) return false;
+
+	g_lineMap.push_back({g_code.size(), curLine + 1});
+	if((res = emitLine("LP %" PRIu32, bestReps)) != 0) return true;
+	for(u32 i = 0; i < bestPeriod; i++)
+	{
+		const char *const next = lineEnd(pos, end);
+		if((res = assembleLine(pos, next, ++curLine, stats)) != 0) return true;
+		pos = next;
+	}
+	res = emitLine("LPEND%c", runCond);
+
+	for(u32 i = bestPeriod; i < bestPeriod * bestReps; i++)
+	{
+		pos = lineEnd(pos, end);
+		curLine++;
+	}
+	g_profileStats.rerolled++;
+
+	return true;
+}
+
+// Applies the profile to the line at pos. Returns false if the line needs no special handling.
+static bool assembleProfiled(const char *&pos, const char *const end, u32 &curLine, AsmStats &stats, int &res)
+{
+	char inBuf[INBUF_SIZE];
+	char *const text = cleanLine(pos, lineEnd(pos, end), inBuf);
+	if(text == nullptr) return false;
+
+	const char *tokens[MAX_TOKENS];
+	tokenize(text, tokens);
+	char cond;
+	if(rerollSize(tokens[0], cond) && profileCold(g_srcFile, curLine + 1))
+		return rerollRun(pos, end, curLine, stats, res);
+	if(strcmp(tokens[0], "LP") != 0 && strcmp(tokens[0], "LPFE") != 0) return false;
+
+	// Find the matching loop end. Loops are hot if any of their lines is.
+	s32 depth = 0;
+	bool hot = false;
+	u32 line = curLine;
+	for(const char *p = pos; p < end;)
+	{
+		const char *const next = lineEnd(p, end);
+		depth += loopDepthDelta(p, next);
+		hot |= profileHot(g_srcFile, ++line);
+		if(depth == 0)
+		{
+			if(!hot) return false;
+
+			res = assembleHotLoop(pos, p, next, curLine, stats);
+			pos = next;
+			return true;
+		}
+		p = next;
+	}
+
+	return false;
+}
+
+// Assembles the lines [pos, end). curLine is the number of the last line assembled.
+static int assembleLines(const char *pos, const char *const end, u32 &curLine, AsmStats &stats)
 {
-	FILE *asmFh = fopen(inFile, "r");
+	while(pos < end)
+	{
+		int res = 0;
+		if(profileLoaded() && assembleProfiled(pos, end, curLine, stats, res))
+		{
+			if(res != 0) return res;
+			continue;
+		}
+
+		const char *const next = lineEnd(pos, end);
+		if((res = assembleLine(pos, next, ++curLine, stats)) != 0) return res;
+		pos = next;
+	}
+
+	return 0;
+}
+
+static void assembleChunk(Chunk &chunk)
+{
+	try
+	{
+		g_code.clear();
+		g_loopDepth = 0;
+		g_alignPads.clear();
+		g_countedLoops = 0;
+		g_lineMap.clear();
+		g_eventRefs.clear();
+		g_newProgs.clear();
+		g_regs = RegTracking{};
+
+		g_srcFile = chunk.srcFile;
+		g_profileStats = ProfileStats{};
+
+		u32 curLine = chunk.firstLine;
+		AsmStats &stats = chunk.stats;
+		const int res = assembleLines(chunk.start, chunk.end, curLine, stats);
+
+		stats.lines = curLine - chunk.firstLine;
+		chunk.res = res;
+		chunk.errLine = curLine;
+		chunk.loopDepth = g_loopDepth;
+		g_code.copyTo(chunk.prog.code);
+		chunk.prog.lineMap = std::move(g_lineMap);
+		chunk.prog.eventRefs = std::move(g_eventRefs);
+		chunk.newProgs = std::move(g_newProgs);
+		chunk.profileStats = g_profileStats;
+	}
+	catch(...)
+	{
+		chunk.exception = std::current_exception();
+	}
+}
+
+// Assembles the chunks on up to jobs threads.
+static void assembleChunks(const std::vector<Chunk*> &todo, u32 jobs)
+{
+	u32 lines = 0;
+	for(const Chunk *chunk : todo) lines += chunk->numLines;
+	u32 numThreads = std::min(jobs, static_cast<u32>(todo.size()));
+	if(lines < PAR_MIN_LINES * 2) numThreads = 1;
+
+	auto worker = [&todo, numThreads](u32 first)
+	{
+		for(u32 i = first; i < todo.size(); i += numThreads) assembleChunk(*todo[i]);
+	};
+
+	std::vector<std::thread> threads;
+	for(u32 i = 1; i < numThreads; i++) threads.emplace_back(worker, i);
+	worker(0);
+	for(std::thread &t : threads) t.join();
+}
+
+static int assembleFile(const char *const inFile, Program &prog, std::vector<Program> &newProgs, u32 jobs, bool cache)
+{
+	FILE *asmFh = fopen(inFile, "rb");
 	if(!asmFh)
 	{
 		fprintf(stderr, "Failed to open '%s'.\n", inFile);
 		return 1;
 	}
 
-	const std::unique_ptr<char[]> inBuf(new(std::nothrow) char[INBUF_SIZE]);
-	if(!inBuf)
+	const auto readStart = std::chrono::steady_clock::now();
+	std::vector<char> src;
+	char readBuf[INBUF_SIZE];
+	size_t read;
+	while((read = fread(readBuf, 1, INBUF_SIZE, asmFh)) > 0) src.insert(src.end(), readBuf, readBuf + read);
+	fclose(asmFh);
+	g_stats.readMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - readStart).count();
+
+	// The register tracking for the region map spans the whole file.
+	// Profile counts are per line and loop alignment needs final positions.
+	if(regionMapLoaded() || profileLoaded() || g_verbose)
+	{
+		jobs = 1;
+		cache = false;
+	}
+
+	const char *const srcEnd = src.data() + src.size();
+	std::vector<Chunk> chunks;
+	std::vector<Chunk*> todo;
+	if(cache)
+	{
+		// Only blocks with changed text are assembled again.
+		ChunkCache &oldCache = g_chunkCache[inFile];
+		chunks = splitBlocks(src.data(), srcEnd);
+		for(Chunk &chunk : chunks)
+		{
+			const auto it = oldCache.find(std::string(chunk.start, chunk.end));
+			if(it != oldCache.cend() && !it->second.exception)
+			{
+				Chunk reused = it->second;
+				reused.start = chunk.start;
+				reused.end = chunk.end;
+				shiftLines(reused, chunk.firstLine);
+				chunk = std::move(reused);
+			}
+			else todo.push_back(&chunk);
+		}
+	}
+	else
 	{
-		fclose(asmFh);
-		return ERR_OUT_OF_MEMORY;
+		chunks = splitChunks(src.data(), srcEnd, jobs);
+		for(Chunk &chunk : chunks) todo.push_back(&chunk);
 	}
+	for(Chunk &chunk : chunks) chunk.srcFile = inFile;
+	assembleChunks(todo, jobs);
 
-	g_progBuf = std::unique_ptr<u8[]>(new(std::nothrow) u8[OUTBUF_SIZE]);
-	if(!g_progBuf)
+	if(cache)
 	{
-		fclose(asmFh);
-		return ERR_OUT_OF_MEMORY;
+		ChunkCache newCache;
+		for(const Chunk &chunk : chunks) newCache.emplace(std::string(chunk.start, chunk.end), chunk);
+		g_chunkCache[inFile] = std::move(newCache);
 	}
 
-	u32 curLine = 0;
 	int res = 0;
-	while(fgets(inBuf.get(), INBUF_SIZE, asmFh))
+	u32 errLine = 0;
+	ProfileStats profileStats{};
+	for(const Chunk &chunk : chunks)
 	{
-		curLine++;
-
-		char *line = const_cast<char*>(findChar(inBuf.get()));
-		if(line == nullptr || *line == '#') continue;
-		strtok(line, "#\n"); // Remove comments and newlines.
-		if(strncmp("DMA", line, 3) == 0) line += 3;
-printf("Line %u: %s\n", curLine, line);
+		if(chunk.exception) std::rethrow_exception(chunk.exception);
+
+		const u32 base = prog.code.size();
+		prog.code.insert(prog.code.end(), chunk.prog.code.cbegin(), chunk.prog.code.cend());
+		for(const LineMapEntry &entry : chunk.prog.lineMap) prog.lineMap.push_back({entry.pos + base, entry.line});
+		for(const EventRef &ref : chunk.prog.eventRefs) prog.eventRefs.push_back({ref.pos + base, ref.line, ref.name});
+		newProgs.insert(newProgs.end(), chunk.newProgs.cbegin(), chunk.newProgs.cend());
+
+		g_stats.lines += chunk.stats.lines;
+		g_stats.lexMs += chunk.stats.lexMs;
+		g_stats.encodeMs += chunk.stats.encodeMs;
+		for(const auto &ms : chunk.stats.mnemonics)
+		{
+			MnemonicStats &total = g_stats.mnemonics[ms.first];
+			total.count += ms.second.count;
+			total.bytes += ms.second.bytes;
+		}
 
-		const char *tokens[MAX_TOKENS];
-		const u32 num = tokenize(line, tokens);
+		profileStats.unrolled += chunk.profileStats.unrolled;
+		profileStats.aligned += chunk.profileStats.aligned;
+		profileStats.rerolled += chunk.profileStats.rerolled;
 
-		if((res = instMap.at(tokens[0])(num, tokens)) != 0) break;
+		res = chunk.res;
+		errLine = chunk.errLine;
+		if(res != 0) break;
 	}
+if(g_verbose)
+{
 printf("Parser res: %d\n\n", res);
-printf("Bytecode: l%u ", g_progPos);
-for(u32 i = 0; i < g_progPos; i++)
+printf("Bytecode: l%zu ", prog.code.size());
+for(u32 i = 0; i < prog.code.size(); i++)
 {
-	printf(" %X", g_progBuf[i]);
+	printf(" %X", prog.code[i]);
 }
 puts("");
-	fclose(asmFh);
+}
+	if(res != 0)
+	{
+		fprintf(stderr, "Error: '%s' line %" PRIu32 ": Error %d.\n", inFile, errLine, res);
+		return res;
+	}
 
-	if(g_loopDepth != 0)
+	if(chunks.back().loopDepth != 0)
 	{
 		fprintf(stderr, "Error: Reached program end before loop end.\n");
 		return ERR_LOOP_WITHOUT_END;
 	}
 	// TODO: Check if last instruction is DMAEND.
 
-	/*FILE *bcodeFh = fopen(outFile, "wb");
+	if(profileLoaded())
+	{
+		printf("Profile '%s': unrolled %" PRIu32 " hot loops, aligned %" PRIu32 " loop heads, re-rolled %" PRIu32
+		       " cold runs.\n", inFile, profileStats.unrolled, profileStats.aligned, profileStats.rerolled);
+	}
+
+	prog.srcFile = inFile;
+	for(Program &newProg : newProgs) newProg.srcFile = inFile;
+
+	return 0;
+}
+
+// Channel program name from the file name. Must be a valid C identifier.
+static std::string progNameFromPath(const char *const path)
+{
+	const char *base = strrchr(path, '/');
+	base = (base ? base + 1 : path);
+
+	std::string name;
+	if(*base >= '0' && *base <= '9') name += '_';
+	for(const char *c = base; *c != '\0' && *c != '.'; c++)
+	{
+		name += (isalnum(static_cast<unsigned char>(*c)) ? *c : '_');
+	}
+
+	return name;
+}
+
+// Looks up the event number of a symbolic operand. New symbols get the
+// lowest number not set in usedMask.
+static int bindEvent(const EventRef &ref, const char *const srcFile, std::vector<EventSymbol> &syms, u32 &usedMask,
+                     u8 &num)
+{
+	const auto it = std::find_if(syms.cbegin(), syms.cend(), [&ref](const EventSymbol &s){ return s.name == ref.name; });
+	if(it != syms.cend())
+	{
+		num = it->num;
+		return 0;
+	}
+
+	if(usedMask == 0xFFFFFFFFu)
+	{
+		fprintf(stderr, "Error: '%s' line %" PRIu32 ": No free event for \"%s\".\n", srcFile, ref.line,
+		        ref.name.c_str());
+		return ERR_OUT_OF_EVENTS;
+	}
+
+	num = __builtin_ctz(~usedMask);
+	usedMask |= 1u<<num;
+	syms.push_back({ref.name, num});
+
+	return 0;
+}
+
+// Assigns event numbers to symbolic DMASEV/DMAWFE operands.
+// Each symbol gets its own number not used explicitly by any program
+// so unrelated channels never serialize on the same event.
+static int allocateEvents(std::vector<Program> &progs, std::vector<EventSymbol> &syms)
+{
+	u32 usedMask = 0;
+	for(const Program &prog : progs)
+	{
+		std::vector<u32> refPos; // Sorted since refs are recorded in program order.
+		for(const EventRef &ref : prog.eventRefs) refPos.push_back(ref.pos);
+
+		DecodedInst di;
+		for(u32 pos = 0; decodeInst(prog.code.data(), prog.code.size(), pos, di); pos += di.size)
+		{
+			if(di.op != INST_SEV && di.op != INST_WFE) continue;
+			if(!std::binary_search(refPos.cbegin(), refPos.cend(), pos)) usedMask |= 1u<<di.num;
+		}
+	}
+
+	for(Program &prog : progs)
+	{
+		for(const EventRef &ref : prog.eventRefs)
+		{
+			u8 num;
+			const int res = bindEvent(ref, prog.srcFile.c_str(), syms, usedMask, num);
+			if(res != 0) return res;
+
+			prog.code[ref.pos + 1] |= (num<<INST_EVENT_SHIFT)>>8;
+		}
+	}
+
+	return 0;
+}
+
+int assemblePrograms(const char *const inFiles[], u32 numFiles, const AsmOpts &opts, std::vector<Program> &progs,
+                     std::vector<EventSymbol> &eventSyms)
+{
+	int res;
+	g_verbose = opts.verbose;
+	g_statsEnabled = opts.stats;
+	g_stats = AsmStats{};
+	u32 jobs = opts.jobs;
+	if(jobs == 0) jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+	progs.clear();
+	eventSyms.clear();
+	for(u32 i = 0; i < numFiles; i++)
+	{
+		Program prog;
+		std::vector<Program> newProgs;
+		prog.name = (numFiles == 1 ? "program" : progNameFromPath(inFiles[i]));
+		if((res = assembleFile(inFiles[i], prog, newProgs, jobs, opts.cache)) != 0) return res;
+		if(prog.code.empty() && newProgs.empty())
+		{
+			fprintf(stderr, "Error: '%s' contains no instructions.\n", inFiles[i]);
+			return ERR_INV_ARG;
+		}
+
+		// Files only containing directives which generate programs.
+		if(!prog.code.empty() || newProgs.empty()) progs.push_back(std::move(prog));
+		for(Program &newProg : newProgs) progs.push_back(std::move(newProg));
+	}
+
+	for(u32 i = 0; i < progs.size(); i++)
+	{
+		for(u32 k = i + 1; k < progs.size(); k++)
+		{
+			if(progs[i].name == progs[k].name)
+			{
+				fprintf(stderr, "Error: Duplicate channel program name \"%s\".\n", progs[i].name.c_str());
+				return ERR_INV_ARG;
+			}
+		}
+	}
+
+	const auto analysisStart = std::chrono::steady_clock::now();
+	if((res = allocateEvents(progs, eventSyms)) != 0) return res;
+
+	if(opts.events)
+	{
+		if((res = checkEvents(progs, eventSyms)) != 0) return res;
+	}
+
+	const LatencyOpts &latOpts = opts.latency;
+	if(latOpts.print || latOpts.maxInsts || latOpts.maxBytes)
+	{
+		for(const Program &prog : progs)
+		{
+			if(progs.size() > 1 && latOpts.print) printf("%s:\n", prog.name.c_str());
+			if((res = checkLatency(prog, latOpts)) != 0) return res;
+		}
+	}
+
+	if(opts.metrics)
+	{
+		for(const Program &prog : progs)
+		{
+			const ProgMetrics m = measureProgram(prog);
+			printf("Metrics '%s': code %zu bytes, executed %" PRIu64 " instructions, fetched %" PRIu64 " bytes, moved %"
+			       PRIu64 " bytes, ", prog.name.c_str(), prog.code.size(), m.insts, m.fetchBytes, m.storeBytes);
+			if(m.storeBytes) printf("%.4f fetched/moved", static_cast<double>(m.fetchBytes) / m.storeBytes);
+			else             printf("n/a fetched/moved");
+			puts(m.complete ? "" : " (step limit reached)");
+		}
+	}
+
+	const ContentionOpts &conOpts = opts.contention;
+	if(conOpts.print || !conOpts.targets.empty())
+	{
+		if((res = checkContention(progs, conOpts)) != 0) return res;
+	}
+
+	g_stats.analysisMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - analysisStart).count();
+
+	return 0;
+}
+
+static void printStats(double outputMs, double totalMs)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("Lines:       %" PRIu32 " (%.0f lines/s)\n", g_stats.lines, g_stats.lines / (totalMs / 1000.0));
+	printf("Time:        read %.3f ms, lex %.3f ms, encode %.3f ms, analysis %.3f ms, output %.3f ms, total %.3f ms\n",
+	       g_stats.readMs, g_stats.lexMs, g_stats.encodeMs, g_stats.analysisMs, outputMs, totalMs);
+	printf("Peak memory: %ld KiB\n", usage.ru_maxrss);
+
+	std::vector<std::pair<std::string, MnemonicStats>> mnemonics(g_stats.mnemonics.cbegin(), g_stats.mnemonics.cend());
+	std::sort(mnemonics.begin(), mnemonics.end(), [](const auto &a, const auto &b)
+	{
+		return (a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first);
+	});
+
+	printf("%-12s %10s %10s\n", "Mnemonic", "Count", "Bytes");
+	for(const auto &ms : mnemonics)
+	{
+		printf("%-12s %10" PRIu32 " %10" PRIu32 "\n", ms.first.c_str(), ms.second.count, ms.second.bytes);
+	}
+}
+
+// Writes the raw bytecode of a single channel program.
+int writeBinary(const std::vector<Program> &progs, const char *const outFile)
+{
+	if(progs.size() != 1)
+	{
+		fprintf(stderr, "Error: Raw binary output needs exactly one channel program.\n");
+		return ERR_INV_ARG;
+	}
+
+	int res = 0;
+	FILE *bcodeFh = fopen(outFile, "wb");
 	if(bcodeFh)
 	{
-		if(fwrite(g_progBuf.get(), 1, g_progPos, bcodeFh) != g_progPos)
+		const std::vector<u8> &code = progs[0].code;
+		if(fwrite(code.data(), 1, code.size(), bcodeFh) != code.size())
 		{
 			fprintf(stderr, "Failed to write to file.\n");
 			res = 2;
@@ -519,8 +1683,253 @@ puts("");
 	{
 		fprintf(stderr, "Failed to open '%s'.\n", outFile);
 		res = 1;
-	}*/
-	res = makeCHeader(g_progBuf.get(), g_progPos, outFile);
+	}
+
+	return res;
+}
+
+// Numbers the named events of a streamed line on first use. Later lines
+// can't change them anymore so numeric events must not reuse them.
+static int bindStreamEvents(u32 lineStart, std::vector<EventSymbol> &syms, u32 &usedMask)
+{
+	std::vector<u8> code(g_code.size() - lineStart);
+	g_code.read(lineStart, code.data(), code.size());
+
+	DecodedInst di;
+	for(u32 pos = 0; decodeInst(code.data(), code.size(), pos, di); pos += di.size)
+	{
+		if(di.op != INST_SEV && di.op != INST_WFE) continue;
+		if(std::any_of(g_eventRefs.cbegin(), g_eventRefs.cend(), [&](const EventRef &r){ return r.pos == lineStart + pos; }))
+			continue;
+
+		for(const EventSymbol &sym : syms)
+		{
+			if(sym.num == di.num)
+			{
+				fprintf(stderr, "Error: Line %" PRIu32 ": Event %u is already used for \"%s\".\n", g_curLine, di.num,
+				        sym.name.c_str());
+				return ERR_OUT_OF_EVENTS;
+			}
+		}
+		usedMask |= 1u<<di.num;
+	}
+
+	for(const EventRef &ref : g_eventRefs)
+	{
+		u8 num;
+		const int res = bindEvent(ref, "-", syms, usedMask, num);
+		if(res != 0) return res;
+
+		u8 b1;
+		g_code.read(ref.pos + 1, &b1, 1);
+		b1 |= (num<<INST_EVENT_SHIFT)>>8;
+		g_code.write(ref.pos + 1, &b1, 1);
+	}
+	g_eventRefs.clear();
+
+	return 0;
+}
+
+// DMAMOV CCR already written to a seekable stream but still in the arena.
+typedef struct
+{
+	long off; // Output file offset. -1 = none.
+	u32  idx; // Index of its first byte in the program.
+} HeldCcr;
+
+// Writes streamed code starting at output byte first. Every byte of the
+// C header takes 6 characters so written bytes can be rewritten in place.
+static int writeStreamCode(FILE *const fh, bool binary, const u8 *const data, u32 size, u32 first)
+{
+	if(binary) return (fwrite(data, 1, size, fh) == size ? 0 : ERR_FILE_WRITE);
+
+	for(u32 i = 0; i < size; i++)
+	{
+		if(fprintf(fh, "%s0x%02" PRIX8, (first + i ? ", " : "\n\t"), data[i]) < 0) return ERR_FILE_WRITE;
+	}
+
+	return 0;
+}
+
+// Writes all code and drops it from the arena. With a region map the cache
+// attributes of the last DMAMOV CCR can still change. Seekable outputs get
+// everything and only the CCR stays at the start of the arena. The next
+// flush rewrites it at held. Other outputs hold back all code from the CCR on.
+// The output is only flushed when the input has no more lines ready.
+static int flushStream(FILE *const in, FILE *const fh, bool binary, bool seekable, u32 &written, HeldCcr &held)
+{
+	const u32 size = g_code.size();
+	std::vector<u8> code(size);
+	g_code.read(0, code.data(), size);
+
+	int res;
+	u32 start = 0; // Arena bytes already written.
+	const HeldCcr prev = held;
+	if(prev.off >= 0)
+	{
+		const long endOff = ftell(fh);
+		if(endOff < 0 || fseek(fh, prev.off, SEEK_SET) != 0) return ERR_FILE_WRITE;
+		if((res = writeStreamCode(fh, binary, code.data(), CCR_INST_SIZE, prev.idx)) != 0) return res;
+		if(fseek(fh, endOff, SEEK_SET) != 0) return ERR_FILE_WRITE;
+		start = CCR_INST_SIZE;
+		held.off = -1;
+	}
+
+	const bool hold = (regionMapLoaded() && g_regs.ccrValid);
+	const u32 end = (hold && !seekable ? g_regs.ccrPos : size);
+	if(end <= start && prev.off < 0) return 0;
+
+	const long off = ftell(fh);
+	if(off < 0 && seekable) return ERR_FILE_WRITE;
+	if((res = writeStreamCode(fh, binary, code.data() + start, end - start, written)) != 0) return res;
+	struct pollfd pfd = {fileno(in), POLLIN, 0};
+	if(poll(&pfd, 1, 0) != 1 && fflush(fh) != 0) return ERR_FILE_WRITE;
+	written += end - start;
+
+	g_code.clear();
+	if(hold && seekable)
+	{
+		g_code.append(code.data() + g_regs.ccrPos, CCR_INST_SIZE);
+		if(g_regs.ccrPos < start) held = prev;
+		else
+		{
+			held.off = off + static_cast<long>(g_regs.ccrPos - start) * (binary ? 1 : 6);
+			held.idx = written - (end - start) + (g_regs.ccrPos - start);
+		}
+		g_regs.ccrPos = 0;
+	}
+	else
+	{
+		g_code.append(code.data() + end, size - end);
+		if(g_regs.ccrValid) g_regs.ccrPos -= end;
+	}
+	g_lineMap.clear();
+
+	return 0;
+}
+
+// Assembles source from a pipe as lines arrive. Code is written whenever no
+// loop is open so memory stays bounded for arbitrarily long streams. The C
+// header variant uses an unsized array and defines the events at the end.
+static int assembleStream(FILE *const in, const char *const outFile, const AsmOpts &opts)
+{
+	const LatencyOpts &latOpts = opts.latency;
+	if(opts.events || latOpts.print || latOpts.maxInsts || latOpts.maxBytes || opts.metrics || opts.contention.print ||
+	   !opts.contention.targets.empty() || opts.profileFile)
+	{
+		fprintf(stderr, "Error: Analyses and profiles need the whole program and don't work with stdin input.\n");
+		return ERR_INV_ARG;
+	}
+
+	FILE *const outFh = fopen(outFile, "wb");
+	if(!outFh)
+	{
+		fprintf(stderr, "Failed to open '%s'.\n", outFile);
+		return 1;
+	}
+	if(!opts.binary) fputs("#include <stdint.h>\n\nstatic const uint8_t program[] =\n{", outFh);
+
+	g_verbose = opts.verbose;
+	g_statsEnabled = opts.stats;
+	g_stats = AsmStats{};
+	g_code.clear();
+	g_loopDepth = 0;
+	g_alignPads.clear();
+	g_countedLoops = 0;
+	g_lineMap.clear();
+	g_eventRefs.clear();
+	g_newProgs.clear();
+	g_regs = RegTracking{};
+	g_srcFile = "-";
+
+	std::vector<EventSymbol> syms;
+	u32 usedMask = 0, written = 0, curLine = 0;
+	HeldCcr held = {-1, 0};
+	const bool seekable = (fseek(outFh, 0, SEEK_CUR) == 0);
+	int res = 0;
+	char inBuf[INBUF_SIZE];
+	while(fgets(inBuf, INBUF_SIZE, in))
+	{
+		const u32 lineStart = g_code.size();
+		if((res = assembleLine(inBuf, inBuf + strlen(inBuf), ++curLine, g_stats)) != 0) break;
+		if(!g_newProgs.empty())
+		{
+			fprintf(stderr, "Error: Directives generating programs don't work with stdin input.\n");
+			res = ERR_INV_ARG;
+			break;
+		}
+		if((res = bindStreamEvents(lineStart, syms, usedMask)) != 0) break;
+		if(g_loopDepth == 0 && (res = flushStream(in, outFh, opts.binary, seekable, written, held)) != 0) break;
+	}
+	g_stats.lines = curLine;
+
+	if(res == ERR_FILE_WRITE) fprintf(stderr, "Failed to write to file.\n");
+	else if(res != 0)         fprintf(stderr, "Error: '-' line %" PRIu32 ": Error %d.\n", curLine, res);
+	else if(g_loopDepth != 0)
+	{
+		fprintf(stderr, "Error: Reached program end before loop end.\n");
+		res = ERR_LOOP_WITHOUT_END;
+	}
+	else
+	{
+		g_regs.ccrValid = false; // No fixups after the last line.
+		res = flushStream(in, outFh, opts.binary, seekable, written, held);
+		if(res == 0 && written == 0)
+		{
+			fprintf(stderr, "Error: '-' contains no instructions.\n");
+			res = ERR_INV_ARG;
+		}
+	}
+
+	if(!opts.binary)
+	{
+		fputs("\n};\n", outFh);
+		if(!syms.empty()) fputs("\n", outFh);
+		for(const EventSymbol &sym : syms) fprintf(outFh, "#define DMA_EVENT_%s (%u)\n", sym.name.c_str(), sym.num);
+	}
+	fclose(outFh);
+
+	return res;
+}
+
+int dma330as(const char *const inFiles[], u32 numFiles, const char *const outFile, const AsmOpts &opts)
+{
+	const auto start = std::chrono::steady_clock::now();
+	int res;
+	if(opts.regionFile && (res = loadRegionMap(opts.regionFile)) != 0) return res;
+	if(opts.profileFile && (res = loadProfile(opts.profileFile)) != 0) return res;
+
+	for(u32 i = 0; i < numFiles; i++)
+	{
+		if(strcmp(inFiles[i], "-") != 0) continue;
+		if(numFiles != 1)
+		{
+			fprintf(stderr, "Error: stdin can't be combined with other input files.\n");
+			return ERR_INV_ARG;
+		}
+
+		res = assembleStream(stdin, outFile, opts);
+		if(opts.stats)
+		{
+			printStats(0.0, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return res;
+	}
+
+	std::vector<Program> progs;
+	std::vector<EventSymbol> eventSyms;
+	if((res = assemblePrograms(inFiles, numFiles, opts, progs, eventSyms)) != 0) return res;
+
+	const auto outputStart = std::chrono::steady_clock::now();
+	if(opts.binary) res = writeBinary(progs, outFile);
+	else            res = makeCHeader(progs, eventSyms, outFile);
+
+	if(opts.stats)
+	{
+		const auto end = std::chrono::steady_clock::now();
+		printStats(std::chrono::duration<double, std::milli>(end - outputStart).count(),
+		           std::chrono::duration<double, std::milli>(end - start).count());
+	}
 
 	return res;
 }
@@ -1,20 +1,36 @@
 #include <cstdio>
+#include <vector>
 #include "types.h"
+#include "program.h"
 
 
 
-int makeCHeader(const u8 *const buf, u32 size, const char *const path)
+int makeCHeader(const std::vector<Program> &progs, const std::vector<EventSymbol> &eventSyms, const char *const path)
 {
 	FILE *fh = fopen(path, "wb");
 	if(fh)
 	{
 		// TODO: Error checking.
-		fprintf(fh, "#include <stdint.h>\n\nstatic const uint8_t program[%" PRIu32 "] =\n{\n\t", size);
-		for(u32 i = 0; i < size - 1; i++)
+		fputs("#include <stdint.h>\n\n", fh);
+		for(const EventSymbol &sym : eventSyms)
 		{
-			fprintf(fh, "0x%02" PRIX8 ", ", buf[i]); // TODO: Newline each X bytes.
+			fprintf(fh, "#define DMA_EVENT_%s (%u)\n", sym.name.c_str(), sym.num);
+		}
+		if(!eventSyms.empty()) fputs("\n", fh);
+
+		for(u32 p = 0; p < progs.size(); p++)
+		{
+			const u8 *const buf = progs[p].code.data();
+			const u32 size = progs[p].code.size();
+
+			if(p > 0) fputs("\n", fh);
+			fprintf(fh, "static const uint8_t %s[%" PRIu32 "] =\n{\n\t", progs[p].name.c_str(), size);
+			for(u32 i = 0; i < size - 1; i++)
+			{
+				fprintf(fh, "0x%02" PRIX8 ", ", buf[i]); // TODO: Newline each X bytes.
+			}
+			fprintf(fh, "0x%02" PRIX8 "\n};\n", buf[size - 1]);
 		}
-		fprintf(fh, "0x%02" PRIX8 "\n};\n", buf[size - 1]);
 
 		fclose(fh);
 	}
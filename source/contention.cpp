@@ -0,0 +1,555 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include "types.h"
+#include "contention.h"
+#include "program.h"
+#include "sim.h"
+#include "disasm.h"
+#include "instructions.h"
+#include "pseudo.h"
+#include "errors.h"
+
+
+#define MODEL_MAX_CYCLES  (1u<<26)
+#define MAX_PLAN_ROUNDS   (64u)
+
+
+typedef struct
+{
+	u32 chan;
+	u32 beats;     // Beats left.
+	u32 beatBytes;
+	u32 fifoBytes; // MFIFO bytes freed when a write burst completes.
+	u32 issued;    // Cycle the burst was issued.
+	bool started;
+} Burst;
+
+typedef struct
+{
+	std::deque<Burst> readQ;
+	std::deque<Burst> writeQ;
+	u32 fifoUsed;  // Bytes reserved in the shared MFIFO.
+	u32 fifoBytes;
+	u32 cycle;
+} AxiState;
+
+typedef struct
+{
+	u32 pc;
+	u32 ccr;
+	u16 lc[2];
+	u8  req;
+	bool done;
+	bool reading;     // Read burst outstanding.
+	bool writing;     // Write burst outstanding.
+	std::map<u32, u32> foreverIters; // DMALPEND position -> iterations taken.
+	u32 fifoData;     // Loaded bytes in the MFIFO not stored yet.
+	u32 fifoPending;  // Reserved MFIFO bytes still on the read bus.
+	u64 beats;
+	u64 moved;
+	u32 maxWait;      // Longest time from burst issue to its first beat.
+	u32 endCycle;     // Cycle after the last beat or DMAEND.
+	u32 readLen;      // Longest read burst in beats.
+	u32 writeLen;     // Longest write burst in beats.
+} ChanModel;
+
+typedef struct
+{
+	u32 read;  // Longest burst lengths in beats. 0 = no transfers.
+	u32 write;
+} BurstLens;
+
+
+
+bool parseChannelTarget(const char *const str, std::vector<ChannelTarget> &targets)
+{
+	const char *const colon = strchr(str, ':');
+	if(!colon || colon == str) return false;
+
+	ChannelTarget target{std::string(str, colon - str), 0, 0};
+	const char *p = colon + 1;
+	while(*p)
+	{
+		u32 *field;
+		if(strncmp(p, "share=", 6) == 0)
+		{
+			field = &target.minShare;
+			p += 6;
+		}
+		else if(strncmp(p, "wait=", 5) == 0)
+		{
+			field = &target.maxWait;
+			p += 5;
+		}
+		else return false;
+
+		char *end;
+		*field = strtoul(p, &end, 0);
+		if(end == p || *field == 0 || (*end != ',' && *end != '\0')) return false;
+		p = (*end == ',' ? end + 1 : end);
+	}
+	if(target.minShare > 100 || (!target.minShare && !target.maxWait)) return false;
+
+	targets.push_back(std::move(target));
+
+	return true;
+}
+
+static void finish(ChanModel &ch, AxiState &axi)
+{
+	ch.done = true;
+	ch.endCycle = std::max(ch.endCycle, axi.cycle + 1);
+	axi.fifoUsed -= ch.fifoData;
+	ch.fifoData = 0;
+}
+
+// Executes the next instruction of a channel. Returns false if the channel
+// waits for the MFIFO, read data or its outstanding burst.
+static bool step(const Program &prog, u32 chan, ChanModel &ch, AxiState &axi)
+{
+	DecodedInst di;
+	if(!decodeInst(prog.code.data(), prog.code.size(), ch.pc, di))
+	{
+		finish(ch, axi);
+		return true;
+	}
+
+	u32 next = ch.pc + di.size;
+	const bool execute = (di.cond == COND_NONE || di.cond == ch.req);
+	switch(di.op)
+	{
+		case INST_END:
+		case INST_KILL:
+			finish(ch, axi);
+			return true;
+		case INST_WFP:
+			ch.req = (di.flags & INST_BIT_BURST || di.flags & INST_BIT_WFP_PERIPH ? COND_BURST : COND_SINGLE);
+			break;
+		case INST_MOV:
+			if(di.flags == 1) ch.ccr = di.imm; // CCR
+			break;
+		case INST_LD:
+		case INST_LDP:
+		{
+			if(!execute) break;
+			if(ch.reading) return false;
+
+			const u32 len   = (ch.ccr>>CCR_SRC_BURST_LEN_SHIFT & 0xFu) + 1;
+			const u32 bytes = len<<(ch.ccr>>CCR_SRC_BURST_SIZE_SHIFT & 7u);
+			// A burst bigger than the whole MFIFO can only start when it's empty.
+			if(axi.fifoUsed != 0 && axi.fifoUsed + bytes > axi.fifoBytes) return false;
+
+			axi.fifoUsed += bytes;
+			ch.fifoPending += bytes;
+			ch.reading = true;
+			ch.readLen = std::max(ch.readLen, len);
+			axi.readQ.push_back(Burst{chan, len, bytes / len, 0, axi.cycle, false});
+			break;
+		}
+		case INST_ST:
+		case INST_STP:
+		case INST_STZ:
+		{
+			if(!execute) break;
+			if(ch.writing) return false;
+
+			const u32 len   = (ch.ccr>>CCR_DST_BURST_LEN_SHIFT & 0xFu) + 1;
+			const u32 bytes = len<<(ch.ccr>>CCR_DST_BURST_SIZE_SHIFT & 7u);
+			u32 fifoBytes = 0;
+			if(di.op != INST_STZ)
+			{
+				if(ch.fifoData < bytes && ch.fifoPending != 0) return false;
+				fifoBytes = std::min(ch.fifoData, bytes);
+				ch.fifoData -= fifoBytes;
+			}
+
+			ch.writing = true;
+			ch.writeLen = std::max(ch.writeLen, len);
+			axi.writeQ.push_back(Burst{chan, len, bytes / len, fifoBytes, axi.cycle, false});
+			break;
+		}
+		case INST_LP:
+			ch.lc[di.lc] = di.imm;
+			break;
+		case INST_LPEND:
+			if(!execute) break;
+			if(di.nf)
+			{
+				if(ch.lc[di.lc] != 0)
+				{
+					ch.lc[di.lc]--;
+					next = ch.pc - di.imm;
+				}
+			}
+			else
+			{
+				u32 &iters = ch.foreverIters[ch.pc];
+				if(++iters < SIM_FOREVER_ITERS) next = ch.pc - di.imm;
+				else iters = 0;
+			}
+			break;
+	}
+
+	ch.pc = next;
+
+	return true;
+}
+
+// Transfers one beat of the oldest burst on a data channel.
+static void busCycle(std::deque<Burst> &q, bool write, std::vector<ChanModel> &chans, AxiState &axi)
+{
+	if(q.empty()) return;
+
+	Burst &b = q.front();
+	ChanModel &ch = chans[b.chan];
+	if(!b.started)
+	{
+		b.started = true;
+		ch.maxWait = std::max(ch.maxWait, axi.cycle - b.issued);
+	}
+
+	ch.beats++;
+	ch.endCycle = std::max(ch.endCycle, axi.cycle + 1);
+	if(write) ch.moved += b.beatBytes;
+	else
+	{
+		ch.fifoPending -= b.beatBytes;
+		if(ch.done) axi.fifoUsed -= b.beatBytes;
+		else        ch.fifoData += b.beatBytes;
+	}
+
+	if(--b.beats == 0)
+	{
+		if(write)
+		{
+			axi.fifoUsed -= b.fifoBytes;
+			ch.writing = false;
+		}
+		else ch.reading = false;
+		q.pop_front();
+	}
+}
+
+// Runs all channels concurrently with waits satisfied immediately like
+// measureProgram(). The instruction engine executes one instruction per
+// cycle for the next ready channel round robin. The AXI read and write data
+// channels move one beat per cycle each and serve bursts in issue order.
+// Each channel has at most one read and one write burst outstanding.
+// Returns false if channels stalled or the cycle limit was hit.
+static bool simulate(const std::vector<Program> &progs, std::vector<ChanModel> &chans, u32 fifoBytes)
+{
+	AxiState axi{};
+	axi.fifoBytes = fifoBytes;
+
+	u32 nextChan = 0;
+	for(; axi.cycle < MODEL_MAX_CYCLES; axi.cycle++)
+	{
+		bool executed = false;
+		for(u32 k = 0; k < chans.size(); k++)
+		{
+			const u32 i = (nextChan + k) % chans.size();
+			if(!chans[i].done && step(progs[i], i, chans[i], axi))
+			{
+				nextChan = i + 1;
+				executed = true;
+				break;
+			}
+		}
+
+		if(!executed && axi.readQ.empty() && axi.writeQ.empty())
+		{
+			return std::all_of(chans.cbegin(), chans.cend(), [](const ChanModel &ch){ return ch.done; });
+		}
+
+		busCycle(axi.readQ, false, chans, axi);
+		busCycle(axi.writeQ, true, chans, axi);
+	}
+
+	return false;
+}
+
+// Worst case wait for the bus. Round robin puts at most one burst
+// of every other channel in front of each burst.
+static u32 waitBound(const std::vector<BurstLens> &lens, u32 chan)
+{
+	u32 reads = 0, writes = 0;
+	for(u32 i = 0; i < lens.size(); i++)
+	{
+		if(i == chan) continue;
+		reads += lens[i].read;
+		writes += lens[i].write;
+	}
+
+	return std::max(reads, writes);
+}
+
+// Share of AXI beats in percent when all channels are busy.
+static double busyShare(const std::vector<BurstLens> &lens, u32 chan)
+{
+	u32 total = 0;
+	for(const BurstLens &l : lens) total += l.read + l.write;
+
+	return (total ? 100.0 * (lens[chan].read + lens[chan].write) / total : 0.0);
+}
+
+static bool meetsTarget(const std::vector<BurstLens> &lens, const std::vector<ChannelTarget> &targets, u32 chan)
+{
+	const ChannelTarget &t = targets[chan];
+	if(t.maxWait && waitBound(lens, chan) > t.maxWait) return false;
+	if(t.minShare && busyShare(lens, chan) < t.minShare) return false;
+
+	return true;
+}
+
+static void halve(BurstLens &l)
+{
+	l.read = (l.read + 1) / 2;
+	l.write = (l.write + 1) / 2;
+}
+
+// Halves the longest bursts of another channel which can give up
+// bandwidth without missing its own target.
+static bool shrinkOther(std::vector<BurstLens> &lens, const std::vector<ChannelTarget> &targets, u32 chan)
+{
+	u32 best = lens.size();
+	u32 bestLen = 1;
+	for(u32 i = 0; i < lens.size(); i++)
+	{
+		const u32 len = std::max(lens[i].read, lens[i].write);
+		if(i == chan || len <= bestLen) continue;
+
+		std::vector<BurstLens> tmp = lens;
+		halve(tmp[i]);
+		if(targets[i].minShare && busyShare(tmp, i) < targets[i].minShare) continue;
+
+		best = i;
+		bestLen = len;
+	}
+	if(best == lens.size()) return false;
+
+	halve(lens[best]);
+
+	return true;
+}
+
+// Doubles the bursts of chan unless that breaks the met wait target of another channel.
+static bool growOwn(std::vector<BurstLens> &lens, const std::vector<ChannelTarget> &targets, u32 chan)
+{
+	const BurstLens &l = lens[chan];
+	if((l.read == 0 || l.read >= MAX_BURST_LEN) && (l.write == 0 || l.write >= MAX_BURST_LEN)) return false;
+
+	std::vector<BurstLens> tmp = lens;
+	tmp[chan].read = std::min(l.read * 2, MAX_BURST_LEN);
+	tmp[chan].write = std::min(l.write * 2, MAX_BURST_LEN);
+	for(u32 i = 0; i < lens.size(); i++)
+	{
+		const u32 maxWait = targets[i].maxWait;
+		if(i != chan && maxWait && waitBound(tmp, i) > maxWait && waitBound(lens, i) <= maxWait) return false;
+	}
+	lens = std::move(tmp);
+
+	return true;
+}
+
+// Adjusts the burst lengths until all targets are met. Returns false if they can't be.
+static bool planBursts(std::vector<BurstLens> &lens, const std::vector<ChannelTarget> &targets)
+{
+	for(u32 round = 0; round < MAX_PLAN_ROUNDS; round++)
+	{
+		bool met = true, changed = false;
+		for(u32 i = 0; i < lens.size(); i++)
+		{
+			if(meetsTarget(lens, targets, i)) continue;
+
+			met = false;
+			const ChannelTarget &t = targets[i];
+			if(t.maxWait && waitBound(lens, i) > t.maxWait) changed |= shrinkOther(lens, targets, i);
+			else changed |= (growOwn(lens, targets, i) || shrinkOther(lens, targets, i));
+		}
+
+		if(met) return true;
+		if(!changed) return false;
+	}
+
+	for(u32 i = 0; i < lens.size(); i++)
+	{
+		if(!meetsTarget(lens, targets, i)) return false;
+	}
+
+	return true;
+}
+
+static u32 scaleLen(u32 len, u32 from, u32 to)
+{
+	if(from == 0 || from == to) return len;
+
+	return std::clamp((len * to + from - 1) / from, 1u, MAX_BURST_LEN);
+}
+
+// Finds the innermost DMALP around the first transfer using the DMAMOV CCR
+// at ccrPos. Returns false if the CCR changes or the program ends first.
+static bool findCcrLoop(const Program &prog, u32 ccrPos, u32 &lpPos, u32 &iters)
+{
+	const u8 *const code = prog.code.data();
+	const u32 size = prog.code.size();
+	DecodedInst di;
+	u32 xfer = 0;
+	for(u32 pos = ccrPos + 6; decodeInst(code, size, pos, di); pos += di.size)
+	{
+		if(di.op == INST_END || (di.op == INST_MOV && di.flags == 1)) return false;
+		if(isTransferInst(di))
+		{
+			xfer = pos;
+			break;
+		}
+	}
+	if(xfer == 0) return false;
+
+	u32 body = 0;
+	for(u32 pos = 0; decodeInst(code, size, pos, di); pos += di.size)
+	{
+		if(di.op != INST_LPEND || !di.nf || di.imm + 2 > pos) continue;
+
+		const u32 start = pos - di.imm;
+		DecodedInst lp;
+		if(start > xfer || xfer >= pos || (body && pos - start >= body)) continue;
+		if(!decodeInst(code, size, start - 2, lp) || lp.op != INST_LP) continue;
+
+		lpPos = start - 2;
+		iters = lp.imm + 1;
+		body = pos - start;
+	}
+
+	return body != 0;
+}
+
+// Prints every DMAMOV CCR of the program with the planned burst lengths
+// and the DMALP count moving the same amount of data with them. CCRs
+// without a DMALP count that can be scaled exactly are left alone.
+static void printSuggestions(const Program &prog, const BurstLens &from, const BurstLens &to)
+{
+	DecodedInst di;
+	for(u32 pos = 0; decodeInst(prog.code.data(), prog.code.size(), pos, di); pos += di.size)
+	{
+		if(di.op != INST_MOV || di.flags != 1) continue;
+
+		const u32 ccr = di.imm;
+		const u32 sb = (ccr>>CCR_SRC_BURST_LEN_SHIFT & 0xFu) + 1;
+		const u32 db = (ccr>>CCR_DST_BURST_LEN_SHIFT & 0xFu) + 1;
+		const u32 newSb = scaleLen(sb, from.read, to.read);
+		const u32 newDb = scaleLen(db, from.write, to.write);
+		if(newSb == sb && newDb == db) continue;
+
+		// Both sides must scale by the same factor to keep the loop balanced.
+		u32 lpPos = 0, iters = 0;
+		const bool scalable = sb * newDb == db * newSb && findCcrLoop(prog, pos, lpPos, iters) &&
+		                      iters * sb % newSb == 0 && iters * sb / newSb >= 1 && iters * sb / newSb <= 256;
+		if(!scalable)
+		{
+			printf("Note: '%s' line %" PRIu32 ": SB%" PRIu32 " DB%" PRIu32 " kept. No DMALP count to scale for SB%"
+			       PRIu32 " DB%" PRIu32 ".\n", prog.name.c_str(), prog.lineAt(pos), sb, db, newSb, newDb);
+			continue;
+		}
+
+		u32 newCcr = ccr & ~(0xFu<<CCR_SRC_BURST_LEN_SHIFT | 0xFu<<CCR_DST_BURST_LEN_SHIFT);
+		newCcr |= (newSb - 1)<<CCR_SRC_BURST_LEN_SHIFT;
+		newCcr |= (newDb - 1)<<CCR_DST_BURST_LEN_SHIFT;
+		printf("Suggestion: '%s' line %" PRIu32 ": DMAMOV CCR %s (was SB%" PRIu32 " DB%" PRIu32 ") with line %"
+		       PRIu32 ": DMALP %" PRIu32 " (was %" PRIu32 ").\n", prog.name.c_str(), prog.lineAt(pos),
+		       formatCcr(newCcr).c_str(), sb, db, prog.lineAt(lpPos), iters * sb / newSb, iters);
+	}
+}
+
+int checkContention(const std::vector<Program> &progs, const ContentionOpts &opts)
+{
+	if(progs.size() > MAX_CHANNELS)
+	{
+		fprintf(stderr, "Warning: %zu channel programs but the DMAC has at most %u channels.\n", progs.size(),
+		        MAX_CHANNELS);
+	}
+
+	std::vector<ChannelTarget> targets(progs.size(), ChannelTarget{});
+	for(const ChannelTarget &t : opts.targets)
+	{
+		const auto it = std::find_if(progs.cbegin(), progs.cend(), [&](const Program &p){ return p.name == t.prog; });
+		if(it == progs.cend())
+		{
+			fprintf(stderr, "Error: Target for unknown channel program \"%s\".\n", t.prog.c_str());
+			return ERR_INV_ARG;
+		}
+
+		ChannelTarget &merged = targets[it - progs.cbegin()];
+		merged.minShare = std::max(merged.minShare, t.minShare);
+		if(t.maxWait) merged.maxWait = (merged.maxWait ? std::min(merged.maxWait, t.maxWait) : t.maxWait);
+	}
+
+	const u32 fifoBytes = (opts.mfifoBytes ? opts.mfifoBytes : MFIFO_DEFAULT_BYTES);
+	std::vector<ChanModel> chans(progs.size(), ChanModel{});
+	for(ChanModel &ch : chans)
+	{
+		ch.ccr = CCR_DEFAULT_VAL;
+		ch.req = COND_BURST;
+	}
+	if(!simulate(progs, chans, fifoBytes))
+		fprintf(stderr, "Warning: Contention model incomplete. Channels stalled on the MFIFO or hit the cycle limit.\n");
+
+	u64 totalBeats = 0;
+	std::vector<BurstLens> lens;
+	for(const ChanModel &ch : chans)
+	{
+		totalBeats += ch.beats;
+		lens.push_back(BurstLens{ch.readLen, ch.writeLen});
+	}
+
+	if(opts.print)
+	{
+		printf("Contention model: %zu channels, %" PRIu32 " bytes MFIFO.\n", progs.size(), fifoBytes);
+		for(u32 i = 0; i < progs.size(); i++)
+		{
+			const ChanModel &ch = chans[i];
+			printf("Channel '%s': moved %" PRIu64 " bytes, %.1f%% of AXI beats (%.1f%% when all busy), %.3f bytes/cycle"
+			       ", worst wait %" PRIu32 " cycles (bound %" PRIu32 ").\n", progs[i].name.c_str(), ch.moved,
+			       (totalBeats ? 100.0 * ch.beats / totalBeats : 0.0), busyShare(lens, i),
+			       (ch.endCycle ? static_cast<double>(ch.moved) / ch.endCycle : 0.0), ch.maxWait, waitBound(lens, i));
+		}
+	}
+	if(opts.targets.empty()) return 0;
+
+	std::vector<BurstLens> plan = lens;
+	const bool met = planBursts(plan, targets);
+	bool changed = false;
+	for(u32 i = 0; i < progs.size(); i++)
+	{
+		if(plan[i].read == lens[i].read && plan[i].write == lens[i].write) continue;
+
+		printSuggestions(progs[i], lens[i], plan[i]);
+		changed = true;
+	}
+
+	if(changed)
+	{
+		for(u32 i = 0; i < progs.size(); i++)
+		{
+			printf("Planned '%s': worst wait %" PRIu32 " cycles, %.1f%% of AXI beats when all busy.\n",
+			       progs[i].name.c_str(), waitBound(plan, i), busyShare(plan, i));
+		}
+	}
+	else if(met) puts("All channel targets are met.");
+
+	for(u32 i = 0; i < progs.size() && !met; i++)
+	{
+		if(meetsTarget(plan, targets, i)) continue;
+
+		fprintf(stderr, "Warning: '%s': Targets can't be met with SB/DB alone (worst wait %" PRIu32
+		        " cycles, %.1f%% of AXI beats when all busy).\n", progs[i].name.c_str(), waitBound(plan, i),
+		        busyShare(plan, i));
+	}
+
+	return 0;
+}
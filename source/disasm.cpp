@@ -0,0 +1,202 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "types.h"
+#include "disasm.h"
+#include "instructions.h"
+
+
+
+static u8 condFromBits(u8 b0)
+{
+	if(!(b0 & INST_BIT_COND)) return COND_NONE;
+
+	return (b0 & INST_BIT_BURST ? COND_BURST : COND_SINGLE);
+}
+
+// Decodes the instruction at pos. Returns false for invalid or truncated instructions.
+bool decodeInst(const u8 *const buf, u32 size, u32 pos, DecodedInst &di)
+{
+	memset(&di, 0, sizeof(DecodedInst));
+	if(pos >= size) return false;
+
+	const u8 b0 = buf[pos];
+	u8 instSize = 1;
+	switch(b0)
+	{
+		case INST_END:
+		case INST_KILL:
+		case INST_NOP:
+		case INST_RMB:
+		case INST_WMB:
+		case INST_STZ:
+			di.op = b0;
+			break;
+		case INST_LD:
+		case INST_LD | INST_BIT_COND:
+		case INST_LD | INST_BIT_COND | INST_BIT_BURST:
+			di.op = INST_LD;
+			di.cond = condFromBits(b0);
+			break;
+		case INST_ST:
+		case INST_ST | INST_BIT_COND:
+		case INST_ST | INST_BIT_COND | INST_BIT_BURST:
+			di.op = INST_ST;
+			di.cond = condFromBits(b0);
+			break;
+		case INST_LP:
+		case INST_LP | INST_BIT_LP_LC1:
+			di.op = INST_LP;
+			di.lc = (b0 & INST_BIT_LP_LC1 ? 1 : 0);
+			instSize = 2;
+			break;
+		case INST_LDP:
+		case INST_LDP | INST_BIT_BURST:
+			di.op = INST_LDP;
+			di.cond = (b0 & INST_BIT_BURST ? COND_BURST : COND_SINGLE);
+			instSize = 2;
+			break;
+		case INST_STP:
+		case INST_STP | INST_BIT_BURST:
+			di.op = INST_STP;
+			di.cond = (b0 & INST_BIT_BURST ? COND_BURST : COND_SINGLE);
+			instSize = 2;
+			break;
+		case INST_LPEND:                      // DMALPFE end.
+		case INST_LPEND | INST_BIT_LPEND_LC1:
+			di.op = INST_LPEND;
+			di.lc = (b0 & INST_BIT_LPEND_LC1 ? 1 : 0);
+			instSize = 2;
+			break;
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER:
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER | INST_BIT_COND:
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER | INST_BIT_COND | INST_BIT_BURST:
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER | INST_BIT_LPEND_LC1:
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER | INST_BIT_LPEND_LC1 | INST_BIT_COND:
+		case INST_LPEND | INST_BIT_LPEND_NOT_FOREVER | INST_BIT_LPEND_LC1 | INST_BIT_COND | INST_BIT_BURST:
+			di.op = INST_LPEND;
+			di.cond = condFromBits(b0);
+			di.lc = (b0 & INST_BIT_LPEND_LC1 ? 1 : 0);
+			di.nf = true;
+			instSize = 2;
+			break;
+		case INST_WFP:
+		case INST_WFP | INST_BIT_WFP_PERIPH:
+		case INST_WFP | INST_BIT_BURST:
+			di.op = INST_WFP;
+			di.flags = b0 & (INST_BIT_WFP_PERIPH | INST_BIT_BURST);
+			instSize = 2;
+			break;
+		case INST_SEV:
+		case INST_FLUSHP:
+		case INST_WFE:
+			di.op = b0;
+			instSize = 2;
+			break;
+		case INST_ADDH:
+		case INST_ADDH | INST_BIT_ADD_DAR:
+		case INST_ADNH:
+		case INST_ADNH | INST_BIT_ADD_DAR:
+			di.op = b0 & ~INST_BIT_ADD_DAR;
+			di.flags = b0 & INST_BIT_ADD_DAR;
+			instSize = 3;
+			break;
+		case INST_GO:
+		case INST_GO | INST_BIT_GO_NON_SEC:
+			di.op = INST_GO;
+			di.flags = b0 & INST_BIT_GO_NON_SEC;
+			instSize = 6;
+			break;
+		case INST_MOV:
+			di.op = INST_MOV;
+			instSize = 6;
+			break;
+		default:
+			return false;
+	}
+
+	if(size - pos < instSize) return false;
+	di.size = instSize;
+
+	u64 raw = 0;
+	memcpy(&raw, &buf[pos], instSize);
+	switch(di.op)
+	{
+		case INST_LP:
+			di.imm = raw>>INST_LP_ITER_SHIFT & 0xFFu;
+			break;
+		case INST_LPEND:
+			di.imm = raw>>INST_LPEND_BACK_JMP_SHIFT & 0xFFu;
+			break;
+		case INST_LDP:
+		case INST_STP:
+		case INST_FLUSHP:
+		case INST_WFP:
+			di.num = raw>>INST_PERIPH_SHIFT & INST_PERIPH_MASK;
+			break;
+		case INST_SEV:
+			di.num = raw>>INST_EVENT_SHIFT & INST_EVENT_MASK;
+			break;
+		case INST_WFE:
+			di.num = raw>>INST_EVENT_SHIFT & INST_EVENT_MASK;
+			di.flags = (raw & INST_BIT_WFE_INVAL ? 1 : 0);
+			break;
+		case INST_ADDH:
+		case INST_ADNH:
+			di.imm = raw>>INST_ADD_IMM_SHIFT & 0xFFFFu;
+			break;
+		case INST_GO:
+			di.num = raw>>INST_GO_CN_SHIFT & INST_GO_CN_MASK;
+			di.imm = static_cast<u32>(raw>>INST_GO_IMM_SHIFT);
+			break;
+		case INST_MOV:
+			di.flags = raw>>INST_MOV_RD_SHIFT & 7u;
+			di.imm = static_cast<u32>(raw>>INST_MOV_IMM_SHIFT);
+			break;
+	}
+
+	return true;
+}
+
+// True for instructions that issue AXI data transfers.
+bool isTransferInst(const DecodedInst &di)
+{
+	switch(di.op)
+	{
+		case INST_LD:
+		case INST_LDP:
+		case INST_ST:
+		case INST_STP:
+		case INST_STZ:
+			return true;
+	}
+
+	return false;
+}
+
+// Formats a CCR value as DMAMOV CCR operands. Zero SP/SC/DP/DC/ES fields are omitted.
+std::string formatCcr(u32 ccr)
+{
+	std::string ops;
+	for(u32 dst = 0; dst < 2; dst++)
+	{
+		const u32 base  = (dst ? CCR_DST_INC_SHIFT : CCR_SRC_INC_SHIFT);
+		const char type = (dst ? 'D' : 'S');
+		const u32 prot  = ccr>>(base + CCR_SRC_PROT_CTRL_SHIFT) & 7u;
+		u32 cache       = ccr>>(base + CCR_SRC_CACHE_CTRL_SHIFT) & 7u;
+		if(dst) cache = (cache & 3u) | (cache & 4u)<<1; // DC is AWCACHE with bit 2 unused.
+
+		char buf[48];
+		int len = snprintf(buf, sizeof(buf), "%s%cA%c %cB%" PRIu32 " %cS%" PRIu32, (dst ? " " : ""), type,
+		                   (ccr>>base & 1u ? 'I' : 'F'), type, (ccr>>(base + CCR_SRC_BURST_LEN_SHIFT) & 0xFu) + 1,
+		                   type, 8u<<(ccr>>(base + CCR_SRC_BURST_SIZE_SHIFT) & 7u));
+		if(prot)  len += snprintf(&buf[len], sizeof(buf) - len, " %cP%" PRIu32, type, prot);
+		if(cache) snprintf(&buf[len], sizeof(buf) - len, " %cC%" PRIu32, type, cache);
+		ops += buf;
+	}
+
+	const u32 swap = ccr>>CCR_ENDIAN_SWAP_SIZE_SHIFT & 7u;
+	if(swap) ops += " ES" + std::to_string(8u<<swap);
+
+	return ops;
+}
@@ -0,0 +1,265 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include "types.h"
+#include "evgraph.h"
+#include "program.h"
+#include "disasm.h"
+#include "instructions.h"
+#include "errors.h"
+
+
+#define NUM_EVENTS        (32u)
+#define SLICE_STEPS       (4096u)    // Instructions per channel and round.
+#define MAX_SIM_ROUNDS    (1u<<16)
+
+
+enum
+{
+	CH_RUNNING = 0u,
+	CH_BLOCKED = 1u,
+	CH_DONE    = 2u
+};
+
+typedef struct
+{
+	u32 pc;
+	u16 lc[2];
+	u8  req;   // Request type of the last DMAWFP.
+	u8  state; // CH_*
+	u8  event; // Event a blocked channel waits for.
+} ChanState;
+
+typedef struct
+{
+	std::vector<u32> sevLines[NUM_EVENTS];
+	std::vector<u32> wfeLines[NUM_EVENTS];
+} ChanEvents;
+
+
+
+static std::string eventName(u8 num, const std::vector<EventSymbol> &syms)
+{
+	std::string name = std::to_string(num);
+	for(const EventSymbol &sym : syms)
+	{
+		if(sym.num == num) return name + " (" + sym.name + ")";
+	}
+
+	return name;
+}
+
+static std::string lineList(const std::vector<u32> &lines)
+{
+	std::string list;
+	for(u32 line : lines)
+	{
+		if(!list.empty()) list += ", ";
+		list += std::to_string(line);
+	}
+
+	return list;
+}
+
+// Runs one channel until it blocks, ends or the slice is used up.
+// Returns true if at least one instruction was executed.
+static bool runSlice(const Program &prog, ChanState &ch, std::vector<ChanState> &chans, u32 &pending)
+{
+	const u8 *const code = prog.code.data();
+	const u32 size = prog.code.size();
+
+	bool progress = false;
+	for(u32 step = 0; step < SLICE_STEPS; step++)
+	{
+		DecodedInst di;
+		if(!decodeInst(code, size, ch.pc, di))
+		{
+			ch.state = CH_DONE;
+			return progress;
+		}
+
+		u32 next = ch.pc + di.size;
+		switch(di.op)
+		{
+			case INST_END:
+			case INST_KILL:
+				ch.state = CH_DONE;
+				return true;
+			case INST_WFP:
+				// Assume peripherals always request. DMAWFP periph as burst.
+				ch.req = (di.flags & (INST_BIT_BURST | INST_BIT_WFP_PERIPH) ? COND_BURST : COND_SINGLE);
+				break;
+			case INST_WFE:
+				if(!(pending & 1u<<di.num))
+				{
+					ch.state = CH_BLOCKED;
+					ch.event = di.num;
+					return progress;
+				}
+				pending &= ~(1u<<di.num);
+				break;
+			case INST_SEV:
+			{
+				// Wakes all waiting channels. Otherwise the event stays pending.
+				bool woken = false;
+				for(ChanState &other : chans)
+				{
+					if(other.state == CH_BLOCKED && other.event == di.num)
+					{
+						other.state = CH_RUNNING;
+						other.pc += 2;
+						woken = true;
+					}
+				}
+				if(!woken) pending |= 1u<<di.num;
+				break;
+			}
+			case INST_LP:
+				ch.lc[di.lc] = di.imm;
+				break;
+			case INST_LPEND:
+				if(di.cond != COND_NONE && di.cond != ch.req) break;
+				if(!di.nf || ch.lc[di.lc] != 0)
+				{
+					if(di.nf) ch.lc[di.lc]--;
+					next = ch.pc - di.imm;
+				}
+				break;
+		}
+
+		ch.pc = next;
+		progress = true;
+	}
+
+	return progress;
+}
+
+// Reports blocked channels which didn't run since round.
+static int reportDeadlock(const std::vector<Program> &progs, const std::vector<EventSymbol> &syms,
+                          const std::vector<ChanState> &chans, const std::vector<u32> &lastRun, u32 round)
+{
+	int res = 0;
+	for(u32 i = 0; i < progs.size(); i++)
+	{
+		const ChanState &ch = chans[i];
+		if(ch.state != CH_BLOCKED || lastRun[i] > round) continue;
+
+		fprintf(stderr, "Error: Deadlock: '%s' line %" PRIu32 " waits for event %s forever.\n",
+		        progs[i].name.c_str(), progs[i].lineAt(ch.pc), eventName(ch.event, syms).c_str());
+		res = ERR_EVENT_DEADLOCK;
+	}
+
+	return res;
+}
+
+// Simulates all channels round robin with peripherals always requesting.
+// Stops when all channels ended, the system state repeats or all
+// remaining channels wait for events nobody can send anymore.
+static int simulate(const std::vector<Program> &progs, const std::vector<EventSymbol> &syms)
+{
+	std::vector<ChanState> chans(progs.size(), ChanState{});
+	std::vector<u32> lastRun(progs.size(), 0); // Last round + 1 each channel executed something.
+	u32 pending = 0;
+	std::map<std::vector<u32>, u32> seen;      // State -> round.
+
+	for(u32 round = 0; round < MAX_SIM_ROUNDS; round++)
+	{
+		bool progress = false;
+		bool allDone = true;
+		for(u32 i = 0; i < progs.size(); i++)
+		{
+			ChanState &ch = chans[i];
+			if(ch.state == CH_BLOCKED && (pending & 1u<<ch.event))
+			{
+				pending &= ~(1u<<ch.event);
+				ch.state = CH_RUNNING;
+				ch.pc += 2;
+			}
+			if(ch.state == CH_RUNNING && runSlice(progs[i], ch, chans, pending))
+			{
+				lastRun[i] = round + 1;
+				progress = true;
+			}
+			allDone &= (ch.state == CH_DONE);
+		}
+
+		if(allDone) return 0;
+		if(!progress) return reportDeadlock(progs, syms, chans, lastRun, round);
+
+		std::vector<u32> state{pending};
+		for(const ChanState &ch : chans)
+		{
+			state.push_back(ch.pc);
+			state.push_back(static_cast<u32>(ch.lc[0])<<16 | ch.lc[1]);
+			state.push_back(static_cast<u32>(ch.req)<<16 | ch.state<<8 | ch.event);
+		}
+		const auto it = seen.find(state);
+		if(it != seen.end())
+		{
+			// Steady state. Channels which didn't run during the whole cycle never will.
+			return reportDeadlock(progs, syms, chans, lastRun, it->second + 1);
+		}
+		seen.emplace(std::move(state), round);
+	}
+
+	fprintf(stderr, "Warning: Event simulation inconclusive after %u rounds.\n", MAX_SIM_ROUNDS);
+
+	return 0;
+}
+
+int checkEvents(const std::vector<Program> &progs, const std::vector<EventSymbol> &syms)
+{
+	std::vector<ChanEvents> chanEvents(progs.size());
+	for(u32 i = 0; i < progs.size(); i++)
+	{
+		const Program &prog = progs[i];
+		DecodedInst di;
+		for(u32 pos = 0; decodeInst(prog.code.data(), prog.code.size(), pos, di); pos += di.size)
+		{
+			if(di.op == INST_SEV)      chanEvents[i].sevLines[di.num].push_back(prog.lineAt(pos));
+			else if(di.op == INST_WFE) chanEvents[i].wfeLines[di.num].push_back(prog.lineAt(pos));
+		}
+	}
+
+	for(u8 e = 0; e < NUM_EVENTS; e++)
+	{
+		std::string senders, waiters;
+		u32 numSenders = 0, numWaiters = 0;
+		for(u32 i = 0; i < progs.size(); i++)
+		{
+			const ChanEvents &ce = chanEvents[i];
+			if(!ce.sevLines[e].empty())
+			{
+				senders += (numSenders++ ? ", " : "") + progs[i].name + " (" + lineList(ce.sevLines[e]) + ")";
+			}
+			if(!ce.wfeLines[e].empty())
+			{
+				waiters += (numWaiters++ ? ", " : "") + progs[i].name + " (" + lineList(ce.wfeLines[e]) + ")";
+			}
+		}
+		if(numSenders == 0 && numWaiters == 0) continue;
+
+		const std::string name = eventName(e, syms);
+		printf("Event %s: %s -> %s\n", name.c_str(), (numSenders ? senders.c_str() : "(none)"),
+		       (numWaiters ? waiters.c_str() : "(none, interrupt?)"));
+
+		if(numWaiters > 0 && numSenders == 0)
+			fprintf(stderr, "Warning: Event %s is waited for but never sent.\n", name.c_str());
+		if(numSenders > 1 || numWaiters > 1)
+			fprintf(stderr, "Warning: Event %s is shared by multiple channels. Unrelated waits serialize.\n",
+			        name.c_str());
+
+		// Waiting for an event only sent by the channel itself either never blocks or never ends.
+		for(u32 i = 0; i < progs.size(); i++)
+		{
+			if(numSenders == 1 && !chanEvents[i].sevLines[e].empty() && !chanEvents[i].wfeLines[e].empty())
+			{
+				fprintf(stderr, "Warning: '%s' line %s: Unnecessary wait for event %s sent by the same channel.\n",
+				        progs[i].name.c_str(), lineList(chanEvents[i].wfeLines[e]).c_str(), name.c_str());
+			}
+		}
+	}
+
+	return simulate(progs, syms);
+}
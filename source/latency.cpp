@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include "types.h"
+#include "latency.h"
+#include "program.h"
+#include "disasm.h"
+#include "instructions.h"
+#include "errors.h"
+
+
+#define LC_UNKNOWN       (0xFFFFu)
+#define WALK_STEP_LIMIT  (1u<<24)
+
+
+typedef struct
+{
+	u32 insts;
+	u32 bytes;
+	bool found;     // At least one path reaches a transfer.
+	bool unbounded; // A path loops without ever reaching a transfer.
+} LatencyBound;
+
+typedef struct
+{
+	u32 insts;
+	u32 bytes;
+	u32 steps;
+	u16 lc[2];
+	std::vector<u32> foreverTaken; // DMALPEND positions of forever loops jumped back already.
+} WalkState;
+
+
+
+// Follows every possible path from pos until the first transfer
+// that executes for request type req. Paths which end in another
+// wait or DMAEND/DMAKILL don't count towards the bound.
+static void walk(const Program &prog, u32 pos, WalkState st, u8 req, LatencyBound &bound)
+{
+	const u8 *const code = prog.code.data();
+	const u32 size = prog.code.size();
+
+	while(1)
+	{
+		if(++st.steps > WALK_STEP_LIMIT)
+		{
+			bound.unbounded = true;
+			return;
+		}
+
+		DecodedInst di;
+		if(!decodeInst(code, size, pos, di)) return;
+		st.insts++;
+		st.bytes += di.size;
+
+		if(isTransferInst(di))
+		{
+			if(di.cond == COND_NONE || di.cond == req)
+			{
+				bound.found = true;
+				bound.insts = std::max(bound.insts, st.insts);
+				bound.bytes = std::max(bound.bytes, st.bytes);
+				return;
+			}
+
+			// Conditional transfers execute as DMANOP on request type mismatch.
+			pos += di.size;
+			continue;
+		}
+
+		switch(di.op)
+		{
+			case INST_END:
+			case INST_KILL:
+			case INST_WFP:
+			case INST_WFE:
+				return;
+			case INST_LP:
+				st.lc[di.lc] = di.imm;
+				break;
+			case INST_LPEND:
+			{
+				if(di.cond != COND_NONE && di.cond != req) break;
+
+				const u32 target = pos - di.imm;
+				if(di.nf)
+				{
+					u16 &lc = st.lc[di.lc];
+					if(lc == LC_UNKNOWN)
+					{
+						// The loop was entered before the wait. Either this was the last
+						// iteration or at most all iterations of the loop follow.
+						WalkState fall = st;
+						fall.lc[di.lc] = 0;
+						walk(prog, pos + di.size, std::move(fall), req, bound);
+
+						DecodedInst lp;
+						u32 iters = 256;
+						if(target >= 2 && decodeInst(code, size, target - 2, lp) && lp.op == INST_LP)
+							iters = lp.imm + 1;
+						if(iters < 2) return;
+
+						lc = iters - 2;
+						pos = target;
+						continue;
+					}
+					else if(lc != 0)
+					{
+						lc--;
+						pos = target;
+						continue;
+					}
+				}
+				else
+				{
+					// A full iteration of a forever loop without transfer or wait never ends.
+					if(std::find(st.foreverTaken.cbegin(), st.foreverTaken.cend(), pos) != st.foreverTaken.cend())
+					{
+						bound.unbounded = true;
+						return;
+					}
+
+					walk(prog, pos + di.size, st, req, bound); // Exit on last request.
+
+					st.foreverTaken.push_back(pos);
+					pos = target;
+					continue;
+				}
+				break;
+			}
+		}
+
+		pos += di.size;
+	}
+}
+
+int checkLatency(const Program &prog, const LatencyOpts &opts)
+{
+	const u8 *const code = prog.code.data();
+	const u32 size = prog.code.size();
+
+	int res = 0;
+	u32 pos = 0;
+	DecodedInst di;
+	while(decodeInst(code, size, pos, di))
+	{
+		if(di.op == INST_WFP || di.op == INST_WFE)
+		{
+			// The request type flag is only known after DMAWFP single/burst.
+			u8 reqs[2] = {COND_SINGLE, COND_BURST};
+			u32 numReqs = 2;
+			if(di.op == INST_WFP && !(di.flags & INST_BIT_WFP_PERIPH))
+			{
+				reqs[0] = (di.flags & INST_BIT_BURST ? COND_BURST : COND_SINGLE);
+				numReqs = 1;
+			}
+
+			LatencyBound bound{};
+			for(u32 i = 0; i < numReqs; i++)
+			{
+				WalkState st{};
+				st.lc[0] = st.lc[1] = LC_UNKNOWN;
+				walk(prog, pos + di.size, std::move(st), reqs[i], bound);
+			}
+
+			const char *const mnemonic = (di.op == INST_WFP ? "DMAWFP P" : "DMAWFE ");
+			const u32 line = prog.lineAt(pos);
+			if(bound.unbounded)
+			{
+				fprintf(stderr, "Warning: Line %" PRIu32 ": %s%u: Path without transfer never ends.\n",
+				        line, mnemonic, di.num);
+				if(opts.maxInsts || opts.maxBytes) res = ERR_LATENCY_BUDGET;
+			}
+			else if(!bound.found)
+			{
+				if(opts.print) printf("Line %" PRIu32 ": %s%u: No transfer before the next wait or program end.\n",
+				                      line, mnemonic, di.num);
+			}
+			else
+			{
+				if(opts.print) printf("Line %" PRIu32 ": %s%u: Worst case %" PRIu32 " instructions, %" PRIu32
+				                      " bytes fetched until first transfer.\n", line, mnemonic, di.num, bound.insts,
+				                      bound.bytes);
+
+				if((opts.maxInsts && bound.insts > opts.maxInsts) || (opts.maxBytes && bound.bytes > opts.maxBytes))
+				{
+					fprintf(stderr, "Error: Line %" PRIu32 ": %s%u: Latency budget exceeded (%" PRIu32
+					        " instructions, %" PRIu32 " bytes).\n", line, mnemonic, di.num, bound.insts, bound.bytes);
+					res = ERR_LATENCY_BUDGET;
+				}
+			}
+		}
+
+		pos += di.size;
+	}
+
+	return res;
+}
@@ -1,66 +1,141 @@
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <exception>
 #include <getopt.h>
+#include <unistd.h>
 #include "types.h"
 #include "asmparse.h"
+#include "watch.h"
 
 
-/*static const char *const versionStr = "splashtool " VERS_STRING;
+static const char *const versionStr = "dma330as " VERS_STRING;
 
 
 
 static void help(void)
 {
 	printf("%s by profi200\n"
-	        "Usage: splashtool [OPTION...] [in png file] [out splash file]\n\n"
-	        "  -f --format=format   Format. Can be RGB565, RGB8 or RGBA8\n"
-	        "  -c --nocompress      Optional. Do not compress data\n"
-	        "  -r --rotate          Optional. Rotate 90 degrees CW\n"
-	        "  -s --swap            Optional. Swap color components\n"
-	        "  -h --help            Give this help list\n"
-	        "  -v --version         Print program version\n\n", versionStr);
-}*/
+	        "Usage: dma330as [OPTION...] [in asm file...] [out header file]\n\n"
+	        "Multiple input files are assembled as separate channel programs.\n"
+	        "Input file - reads from stdin and writes code as lines arrive. Output file -\n"
+	        "writes to stdout. Reports go to stderr then.\n\n"
+	        "  -l --latency              Print the worst case request to transfer latency\n"
+	        "                            of each DMAWFP/DMAWFE\n"
+	        "  -L --latency-budget=N     Fail if a latency exceeds N instructions\n"
+	        "  -B --latency-bytes=N      Fail if a latency exceeds N instruction bytes fetched\n"
+	        "  -e --events               Print the DMASEV -> DMAWFE graph of all channel\n"
+	        "                            programs and check for deadlocks\n"
+	        "  -r --regions=FILE         Memory region map. Picks the fastest legal AXI cache\n"
+	        "                            attributes for DMAMOV CCR without SC/DC\n"
+	        "  -p --profile=FILE         Execution counts per source line. Unrolls hot\n"
+	        "                            DMALP loops, aligns hot loop heads to 32 bytes and\n"
+	        "                            re-rolls cold runs of conditional transfers\n"
+	        "  -j --jobs=N               Assemble large files with N threads. Default: all cores\n"
+	        "  -w --watch                Stay resident and reassemble when an input file,\n"
+	        "                            the region map or the profile changes. Only\n"
+	        "                            changed parts of input files are assembled again\n"
+	        "  -s --socket=PATH          Watch and push the bytecode to clients of the Unix\n"
+	        "                            socket PATH\n"
+	        "  -m --metrics              Simulate each program and print the instruction\n"
+	        "                            bytes fetched per data byte moved\n"
+	        "  -c --contention           Model all channels sharing the AXI master and MFIFO\n"
+	        "                            and print bandwidth shares and worst case waits\n"
+	        "  -t --target=NAME:share=N,wait=N\n"
+	        "                            Suggest SB/DB so channel program NAME gets at least\n"
+	        "                            N%% of the AXI beats and/or waits at most N cycles\n"
+	        "  -M --mfifo=N              MFIFO size in bytes for -c/-t. Default: 512\n"
+	        "  -b --binary               Write raw bytecode instead of a C header\n"
+	        "  -S --stats                Print throughput, time per stage, peak memory and\n"
+	        "                            instruction counts and bytes per mnemonic\n"
+	        "  -V --verbose              Print the parser trace and bytecode\n"
+	        "  -h --help                 Give this help list\n"
+	        "  -v --version              Print program version\n\n", versionStr);
+}
 
 int main(int argc, char *const argv[])
 {
-	/*static const struct option long_options[] =
-	{{"format",     required_argument, 0, 'f'},
-	 {"nocompress",       no_argument, 0, 'c'},
-	 {"rotate",           no_argument, 0, 'r'},
-	 {"swap",             no_argument, 0, 's'},
-	 {"help",             no_argument, 0, 'h'},
-	 {"version",          no_argument, 0, 'v'},
-	 {0,            0,                 0,   0}
+	static const struct option long_options[] =
+	{{"latency",              no_argument, 0, 'l'},
+	 {"latency-budget", required_argument, 0, 'L'},
+	 {"latency-bytes",  required_argument, 0, 'B'},
+	 {"events",               no_argument, 0, 'e'},
+	 {"regions",        required_argument, 0, 'r'},
+	 {"profile",        required_argument, 0, 'p'},
+	 {"jobs",           required_argument, 0, 'j'},
+	 {"watch",                no_argument, 0, 'w'},
+	 {"socket",         required_argument, 0, 's'},
+	 {"metrics",              no_argument, 0, 'm'},
+	 {"contention",           no_argument, 0, 'c'},
+	 {"target",         required_argument, 0, 't'},
+	 {"mfifo",          required_argument, 0, 'M'},
+	 {"binary",               no_argument, 0, 'b'},
+	 {"stats",                no_argument, 0, 'S'},
+	 {"verbose",              no_argument, 0, 'V'},
+	 {"help",                 no_argument, 0, 'h'},
+	 {"version",              no_argument, 0, 'v'},
+	 {0,                0,                 0,   0}
 	};
 
-	u32 flags = FLAG_COMPRESSED | FORMAT_INVALID;
+	AsmOpts opts{};
 	while(1)
 	{
-		int c = getopt_long(argc, argv, "f:crshv", long_options, 0);
+		int c = getopt_long(argc, argv, "lL:B:er:p:j:ws:mct:M:bSVhv", long_options, 0);
 		if(c == -1) break;
 
 		switch(c)
 		{
-			case 'f':
-				flags = flags & ~FORMAT_INVALID;
-				if(!strncmp(optarg, "RGB565", 6)) flags |= FORMAT_RGB565;
-				else if(!strncmp(optarg, "RGB8", 4)) flags |= FORMAT_RGB8;
-				else if(!strncmp(optarg, "RGBA8", 5)) flags |= FORMAT_RGBA8;
-				else
+			case 'l':
+				opts.latency.print = true;
+				break;
+			case 'L':
+				opts.latency.maxInsts = strtoul(optarg, nullptr, 0);
+				break;
+			case 'B':
+				opts.latency.maxBytes = strtoul(optarg, nullptr, 0);
+				break;
+			case 'e':
+				opts.events = true;
+				break;
+			case 'r':
+				opts.regionFile = optarg;
+				break;
+			case 'p':
+				opts.profileFile = optarg;
+				break;
+			case 'j':
+				opts.jobs = strtoul(optarg, nullptr, 0);
+				break;
+			case 'w':
+				opts.watch = true;
+				break;
+			case 's':
+				opts.socketPath = optarg;
+				break;
+			case 'm':
+				opts.metrics = true;
+				break;
+			case 'c':
+				opts.contention.print = true;
+				break;
+			case 't':
+				if(!parseChannelTarget(optarg, opts.contention.targets))
 				{
-					help();
+					fprintf(stderr, "Error: Invalid target \"%s\".\n", optarg);
 					return 1;
 				}
 				break;
-			case 'c':
-				flags = flags & ~FLAG_COMPRESSED;
+			case 'M':
+				opts.contention.mfifoBytes = strtoul(optarg, nullptr, 0);
 				break;
-			case 'r':
-				flags |= FLAG_ROTATED;
+			case 'b':
+				opts.binary = true;
 				break;
-			case 's':
-				flags |= FLAG_SWAPPED;
+			case 'S':
+				opts.stats = true;
+				break;
+			case 'V':
+				opts.verbose = true;
 				break;
 			case 'h':
 				help();
@@ -77,25 +152,51 @@ int main(int argc, char *const argv[])
 		}
 	}
 
-	if(argc - optind < 2 || argc - optind > 2)
+	if(argc - optind < 2)
 	{
 		help();
 		return 1;
 	}
-	const char *inFile = argv[optind];
-	const char *outFile = argv[optind + 1];
+	const char *const *inFiles = &argv[optind];
+	const u32 numFiles = argc - optind - 1;
+	const char *outFile = argv[argc - 1];
 
+	const bool watch = (opts.watch || opts.socketPath);
+	for(u32 i = 0; i < numFiles && watch; i++)
+	{
+		if(strcmp(inFiles[i], "-") == 0)
+		{
+			fprintf(stderr, "Error: Watch mode can't read stdin.\n");
+			return 1;
+		}
+	}
 
-	if((flags & FORMAT_INVALID) == FORMAT_INVALID)
+	char outPath[32];
+	if(strcmp(outFile, "-") == 0)
 	{
-		fprintf(stderr, "Warning: No format specified. Assuming RGB565.\n");
-		flags &= ~FORMAT_INVALID;
-	}*/
+		if(watch)
+		{
+			fprintf(stderr, "Error: Watch mode can't write to stdout.\n");
+			return 1;
+		}
+
+		// Keep the real stdout for the output and send all reports to stderr.
+		fflush(stdout);
+		const int outFd = dup(STDOUT_FILENO);
+		if(outFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		{
+			perror("Failed to redirect stdout");
+			return 1;
+		}
+		snprintf(outPath, sizeof(outPath), "/dev/fd/%d", outFd);
+		outFile = outPath;
+	}
 
 	int res;
 	try
 	{
-		res = dma330as(argv[1], argv[2]);
+		if(watch) res = watchFiles(inFiles, numFiles, outFile, opts);
+		else      res = dma330as(inFiles, numFiles, outFile, opts);
 	}
 	catch(const std::exception& e)
 	{
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include "types.h"
+#include "profile.h"
+#include "asmparse.h"
+#include "utils.h"
+#include "errors.h"
+
+
+typedef std::unordered_map<u32, u64> LineCounts;
+
+static std::unordered_map<std::string, LineCounts> g_profile; // Per source file. "" = all files.
+static u64 g_maxCount = 0;
+
+
+
+// Profile format. One execution count per source line:
+// [<source file>:]<line> <count>  # comment
+// Counts without file apply to all input files.
+int loadProfile(const char *const path)
+{
+	FILE *fh = fopen(path, "r");
+	if(!fh)
+	{
+		fprintf(stderr, "Failed to open '%s'.\n", path);
+		return ERR_FILE_OPEN;
+	}
+
+	const std::unique_ptr<char[]> inBuf(new(std::nothrow) char[INBUF_SIZE]);
+	if(!inBuf)
+	{
+		fclose(fh);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	g_profile.clear();
+	g_maxCount = 0;
+	u32 curLine = 0;
+	int res = 0;
+	while(fgets(inBuf.get(), INBUF_SIZE, fh))
+	{
+		curLine++;
+
+		char *line = const_cast<char*>(findChar(inBuf.get()));
+		if(line == nullptr || *line == '#') continue;
+		strtok(line, "#\n"); // Remove comments and newlines.
+
+		char *const keyStr = strtok(line, " \t");
+		const char *const countStr = strtok(nullptr, " \t");
+
+		std::string file;
+		const char *lineStr = keyStr;
+		char *const colon = strrchr(keyStr, ':');
+		if(colon)
+		{
+			*colon = '\0';
+			file = keyStr;
+			lineStr = colon + 1;
+		}
+
+		u32 srcLine;
+		char *end;
+		const u64 count = (countStr ? strtoull(countStr, &end, 0) : 0);
+		if(!countStr || *end != '\0' || !parseNum(lineStr, srcLine) || srcLine == 0)
+		{
+			fprintf(stderr, "Error: '%s' line %" PRIu32 ": Invalid profile entry.\n", path, curLine);
+			res = ERR_INV_ARG;
+			break;
+		}
+
+		g_profile[file][srcLine] = count;
+		if(count > g_maxCount) g_maxCount = count;
+	}
+
+	fclose(fh);
+
+	return res;
+}
+
+bool profileLoaded(void)
+{
+	return !g_profile.empty();
+}
+
+// Execution count of a source line or -1 if the profile has none.
+static s64 profileCount(const char *const srcFile, u32 line)
+{
+	const char *base = strrchr(srcFile, '/');
+	base = (base ? base + 1 : srcFile);
+
+	for(const char *const file : {srcFile, base, ""})
+	{
+		const auto it = g_profile.find(file);
+		if(it == g_profile.cend()) continue;
+
+		const auto lineIt = it->second.find(line);
+		if(lineIt != it->second.cend()) return lineIt->second;
+	}
+
+	return -1;
+}
+
+bool profileHot(const char *const srcFile, u32 line)
+{
+	const s64 count = profileCount(srcFile, line);
+
+	return count > 1 && static_cast<u64>(count) * PROFILE_HOT_DIV >= g_maxCount;
+}
+
+bool profileCold(const char *const srcFile, u32 line)
+{
+	const s64 count = profileCount(srcFile, line);
+
+	return count >= 0 && static_cast<u64>(count) * PROFILE_COLD_DIV <= g_maxCount;
+}
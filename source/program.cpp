@@ -0,0 +1,17 @@
+#include <algorithm>
+#include "types.h"
+#include "program.h"
+
+
+
+// Returns the source line the instruction at pos was generated from or 0.
+u32 Program::lineAt(u32 pos) const
+{
+	// Lines which don't emit anything (DMALPFE) share the position
+	// with the next line. Take the last entry.
+	const auto it = std::upper_bound(lineMap.cbegin(), lineMap.cend(), pos,
+	                                 [](u32 p, const LineMapEntry &e){ return p < e.pos; });
+	if(it == lineMap.cbegin()) return 0;
+
+	return (it - 1)->line;
+}
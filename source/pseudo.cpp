@@ -0,0 +1,462 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include "types.h"
+#include "pseudo.h"
+#include "asmparse.h"
+#include "instructions.h"
+#include "utils.h"
+#include "errors.h"
+
+
+typedef struct
+{
+	u32 beat;   // Beat size in bytes.
+	u32 len;    // Beats per burst.
+	u32 bursts; // Number of full bursts.
+	u32 tail;   // Beats of the final short burst. 0 = none.
+} BurstPlan;
+
+
+
+static int emitCcr(bool srcInc, bool dstInc, u32 beat, u32 len)
+{
+	return emitLine("MOV CCR SA%c SB%" PRIu32 " SS%" PRIu32 " DA%c DB%" PRIu32 " DS%" PRIu32,
+	                (srcInc ? 'I' : 'F'), len, beat * 8, (dstInc ? 'I' : 'F'), len, beat * 8);
+}
+
+// Sets SAR/DAR from cur to target. Uses DMAADDH/DMAADNH if it fits in one.
+static int emitSetAddr(const char *const reg, u32 cur, u32 target)
+{
+	const s64 delta = static_cast<s64>(target) - cur;
+	if(delta == 0) return 0;
+	if(delta > 0 && delta <= 0xFFFF) return emitLine("ADDH %s %" PRIu32, reg, static_cast<u32>(delta));
+	if(delta < 0 && delta >= -0x10000) return emitLine("ADNH %s %" PRIu32, reg, static_cast<u32>(delta + 0x10000));
+
+	return emitLine("MOV %s %" PRIu32, reg, target);
+}
+
+template<typename F> static int emitLoop(u32 iter, F body)
+{
+	if(iter == 1) return body();
+
+	int res;
+	if((res = emitLine("LP %" PRIu32, iter)) != 0) return res;
+	if((res = body()) != 0) return res;
+
+	return emitLine("LPEND");
+}
+
+// Adds delta to SAR/DAR inside loops. Large deltas take multiple DMAADDH/DMAADNH.
+static int emitAddrStep(const char *const reg, s64 delta)
+{
+	int res = 0;
+	while(delta > 0 && res == 0)
+	{
+		const u32 step = (delta > 0xFFFF ? 0xFFFF : static_cast<u32>(delta));
+		res = emitLine("ADDH %s %" PRIu32, reg, step);
+		delta -= step;
+	}
+	while(delta < 0 && res == 0)
+	{
+		const s64 step = (delta < -0x10000 ? -0x10000 : delta);
+		res = emitLine("ADNH %s %" PRIu32, reg, static_cast<u32>(step + 0x10000));
+		delta -= step;
+	}
+
+	return res;
+}
+
+// Emits body count times. The count is factored across both loop
+// counters if free and allowed. A remainder gets its own loop.
+template<typename F> static int emitRepeat(u32 count, F body, u32 maxLCs = 2)
+{
+	int res;
+	const u32 freeLCs = std::min(freeLoopCounters(), maxLCs);
+	if(count == 0) return 0;
+	if(freeLCs == 0)
+	{
+		if(count > MAX_BURST_LEN) return ERR_NOT_ENOUGH_LCs;
+		for(u32 i = 0; i < count; i++) if((res = body()) != 0) return res;
+		return 0;
+	}
+
+	if(freeLCs == 1 || count <= 256)
+	{
+		while(count > 0)
+		{
+			const u32 iter = (count > 256 ? 256 : count);
+			if((res = emitLoop(iter, body)) != 0) return res;
+			count -= iter;
+		}
+		return 0;
+	}
+
+	auto nest = [&body](u32 outer, u32 inner)
+	{
+		return emitLoop(outer, [&body, inner](){ return emitLoop(inner, body); });
+	};
+
+	while(count > 256 * 256)
+	{
+		if((res = nest(256, 256)) != 0) return res;
+		count -= 256 * 256;
+	}
+
+	// Largest inner count which divides the count without remainder.
+	for(u32 inner = 256; inner >= (count + 255) / 256; inner--)
+	{
+		if(count % inner == 0) return nest(count / inner, inner);
+	}
+
+	if((res = nest(count / 256, 256)) != 0) return res;
+
+	return emitRepeat(count % 256, body, maxLCs);
+}
+
+// Largest beat size in bytes all addresses and sizes or'd together in align are a multiple of.
+static u32 maxBeat(u32 align)
+{
+	u32 beat = AXI_BUS_BYTES;
+	while(align & (beat - 1)) beat >>= 1;
+
+	return beat;
+}
+
+// Splits bytes into bursts of beat sized transfers. Burst lengths
+// without a tail are preferred as long as they are at least half the maximum.
+static BurstPlan planBursts(u32 bytes, u32 beat)
+{
+	const u32 beats = bytes / beat;
+	u32 len = (beats < MAX_BURST_LEN ? beats : MAX_BURST_LEN);
+	for(u32 l = len; l >= MAX_BURST_LEN / 2 && l > 1; l--)
+	{
+		if(beats % l == 0)
+		{
+			len = l;
+			break;
+		}
+	}
+
+	return {beat, len, beats / len, beats % len};
+}
+
+// Emits all bursts of a plan. The CCR must be set up for plan.len beforehand
+// and is restored after the tail if requested.
+template<typename F> static int emitPlan(const BurstPlan &plan, bool srcInc, bool dstInc, F body, bool restore = true)
+{
+	int res;
+	if((res = emitRepeat(plan.bursts, body)) != 0) return res;
+
+	if(plan.tail)
+	{
+		if((res = emitCcr(srcInc, dstInc, plan.beat, plan.tail)) != 0) return res;
+		if((res = body()) != 0) return res;
+		if(restore) res = emitCcr(srcInc, dstInc, plan.beat, plan.len);
+	}
+
+	return res;
+}
+
+// COPY2D src, dst, width, height, srcPitch, dstPitch
+// Copies a rectangle of height rows with width bytes each. Pitches are the
+// distance between the start of 2 rows. Clobbers SAR, DAR and CCR.
+int emitCopy2d(u32 argc, const char *const argv[MAX_TOKENS])
+{
+	if(argc != 7) return ERR_INV_PARSER_ARGS;
+
+	u32 src, dst, width, height, srcPitch, dstPitch;
+	if(!parseNum(argv[1], src) || !parseNum(argv[2], dst) || !parseNum(argv[3], width) ||
+	   !parseNum(argv[4], height) || !parseNum(argv[5], srcPitch) || !parseNum(argv[6], dstPitch))
+		return ERR_INV_PARSER_ARGS;
+	if(width == 0 || height == 0) return ERR_OUT_OF_RANGE;
+
+	int res;
+	if((res = emitLine("MOV SAR %" PRIu32, src)) != 0) return res;
+	if((res = emitLine("MOV DAR %" PRIu32, dst)) != 0) return res;
+
+	auto copyBurst = [](){ int r = emitLine("LD"); return (r ? r : emitLine("ST")); };
+
+	// Contiguous rectangles are a single linear copy.
+	if(srcPitch == width && dstPitch == width && static_cast<u64>(width) * height <= 0xFFFFFFFFu)
+	{
+		const u32 total = width * height;
+		const BurstPlan plan = planBursts(total, maxBeat(src | dst | total));
+		if((res = emitCcr(true, true, plan.beat, plan.len)) != 0) return res;
+
+		return emitPlan(plan, true, true, copyBurst, false);
+	}
+
+	const BurstPlan plan = planBursts(width, maxBeat(src | dst | width | srcPitch | dstPitch));
+	if((res = emitCcr(true, true, plan.beat, plan.len)) != 0) return res;
+
+	auto row = [&plan, &copyBurst, width, srcPitch, dstPitch]()
+	{
+		int r;
+		if((r = emitPlan(plan, true, true, copyBurst)) != 0) return r;
+		if((r = emitAddrStep("SAR", static_cast<s64>(srcPitch) - width)) != 0) return r;
+		return emitAddrStep("DAR", static_cast<s64>(dstPitch) - width);
+	};
+
+	// Rows needing their own loop leave one loop counter free.
+	return emitRepeat(height, row, (plan.bursts > 1 ? 1 : 2));
+}
+
+// Transfers bytes to incrementing memory at dst in up to 3 segments.
+// An unaligned head, the bus width aligned bulk and the remaining tail
+// each with the widest beats possible. With a pattern every segment
+// points SAR at the pattern bytes matching the phase of dst. The bulk
+// replays the whole pattern from a fixed address while head and tail
+// read the part they need incrementing.
+template<typename F> static int emitLinear(u32 dst, u32 bytes, const u32 *const pattern, F body)
+{
+	bool sarValid = false;
+	u32 sar = 0;
+	while(bytes > 0)
+	{
+		u32 seg = bytes;
+		if(dst & (AXI_BUS_BYTES - 1)) seg = std::min(bytes, AXI_BUS_BYTES - (dst & (AXI_BUS_BYTES - 1)));
+		else if(bytes >= AXI_BUS_BYTES) seg = bytes & ~(AXI_BUS_BYTES - 1);
+
+		const bool srcInc = (!pattern || seg < AXI_BUS_BYTES);
+		const BurstPlan plan = planBursts(seg, maxBeat(dst | seg));
+		int res;
+		if(pattern && (!sarValid || sar != *pattern + (dst & (AXI_BUS_BYTES - 1))))
+		{
+			sar = *pattern + (dst & (AXI_BUS_BYTES - 1));
+			sarValid = true;
+			if((res = emitLine("MOV SAR %" PRIu32, sar)) != 0) return res;
+		}
+		if(srcInc) sar += seg;
+		if((res = emitCcr(srcInc, true, plan.beat, plan.len)) != 0) return res;
+		if((res = emitPlan(plan, srcInc, true, body, false)) != 0) return res;
+
+		dst += seg;
+		bytes -= seg;
+	}
+
+	return 0;
+}
+
+// ZERO dst, bytes
+// Zeroes memory with DMASTZ. No reads at all. Clobbers DAR and CCR.
+int emitZero(u32 argc, const char *const argv[MAX_TOKENS])
+{
+	if(argc != 3) return ERR_INV_PARSER_ARGS;
+
+	u32 dst, bytes;
+	if(!parseNum(argv[1], dst) || !parseNum(argv[2], bytes)) return ERR_INV_PARSER_ARGS;
+
+	int res;
+	if((res = emitLine("MOV DAR %" PRIu32, dst)) != 0) return res;
+
+	return emitLinear(dst, bytes, nullptr, [](){ return emitLine("STZ"); });
+}
+
+// FILL dst, bytes, pattern
+// Fills memory with the bus width sized pattern stored at address pattern.
+// The MFIFO can't replay data so every store burst is fed by a fixed
+// address source burst from the pattern. Unaligned heads and tails use
+// the pattern bytes in the same byte lanes. pattern must be bus width
+// aligned. Clobbers SAR, DAR and CCR.
+int emitFill(u32 argc, const char *const argv[MAX_TOKENS])
+{
+	if(argc != 4) return ERR_INV_PARSER_ARGS;
+
+	u32 dst, bytes, pattern;
+	if(!parseNum(argv[1], dst) || !parseNum(argv[2], bytes) || !parseNum(argv[3], pattern))
+		return ERR_INV_PARSER_ARGS;
+	if(pattern & (AXI_BUS_BYTES - 1)) return ERR_OUT_OF_RANGE;
+
+	int res;
+	if((res = emitLine("MOV DAR %" PRIu32, dst)) != 0) return res;
+
+	return emitLinear(dst, bytes, &pattern, [](){ int r = emitLine("LD"); return (r ? r : emitLine("ST")); });
+}
+
+// Accepts "P<num>" and "<num>".
+static bool parsePeriph(const char *const str, u32 &periph)
+{
+	return parseNum((*str == 'P' ? str + 1 : str), periph) && periph <= INST_PERIPH_MASK;
+}
+
+// Parses "key=value" arguments.
+static bool parseKeyVal(const char *const arg, const char *const key, const char *&val)
+{
+	const size_t keyLen = strlen(key);
+	if(strncmp(arg, key, keyLen) != 0 || arg[keyLen] != '=') return false;
+	val = &arg[keyLen + 1];
+
+	return true;
+}
+
+// .pipeline name rx=P<n> src=<addr> buf0=<addr> buf1=<addr> size=<bytes> dst=<addr> [tx=P<n>] [width=<bits>] [burst=<beats>]
+// Generates 2 channel programs. <name>_rx fills buf0 and buf1 alternately
+// from the peripheral FIFO at src while <name>_tx drains the other buffer
+// to dst. dst is a ring of 2 * size bytes of memory getting the buffers in
+// turn or the FIFO of peripheral tx. The buffers are handed over with
+// symbolic events <name>_full0/1 and <name>_empty0/1 after a barrier so
+// all transfers of a buffer completed before the other side touches it.
+int dirPipeline(u32 argc, const char *const argv[MAX_TOKENS])
+{
+	if(argc < 8) return ERR_INV_PARSER_ARGS;
+
+	const char *const name = argv[1];
+	u32 rx = 0, tx = 0, src = 0, buf[2] = {0}, size = 0, dst = 0, width = 32, burst = 4;
+	bool hasTx = false;
+	u32 found = 0;
+	for(u32 i = 2; i < argc; i++)
+	{
+		static const char *const keys[9] = {"rx", "tx", "src", "buf0", "buf1", "size", "dst", "width", "burst"};
+		u32 *const vals[9] = {&rx, &tx, &src, &buf[0], &buf[1], &size, &dst, &width, &burst};
+
+		const char *val;
+		u32 k = 0;
+		while(k < 9 && !parseKeyVal(argv[i], keys[k], val)) k++;
+		if(k == 9) return ERR_INV_PARSER_ARGS;
+
+		if(k < 2)
+		{
+			if(!parsePeriph(val, *vals[k])) return ERR_OUT_OF_RANGE;
+		}
+		else if(!parseNum(val, *vals[k])) return ERR_INV_PARSER_ARGS;
+
+		found |= 1u<<k;
+		if(k == 1) hasTx = true;
+	}
+	if((found & 0x7Du) != 0x7Du) return ERR_INV_PARSER_ARGS; // rx, src, buf0, buf1, size and dst are required.
+
+	const u32 beat = width / 8;
+	if(width < 8 || width > AXI_BUS_BYTES * 8 || (width & (width - 1)) != 0) return ERR_OUT_OF_RANGE;
+	if(burst < 1 || burst > MAX_BURST_LEN) return ERR_OUT_OF_RANGE;
+	const u32 reqBytes = beat * burst;
+	if(size == 0 || size % reqBytes != 0) return ERR_OUT_OF_RANGE;
+	const u32 requests = size / reqBytes;
+	if(!hasTx && static_cast<u64>(dst) + 2ull * size > 0x100000000ull) return ERR_OUT_OF_RANGE;
+
+	const std::string prefix(name);
+	const std::string full[2] = {prefix + "_full0", prefix + "_full1"};
+	const std::string empty[2] = {prefix + "_empty0", prefix + "_empty1"};
+	int res;
+
+
+	// Producer. One burst per peripheral request.
+	if((res = beginProgram()) != 0) return res;
+	if((res = emitCcr(false, true, beat, burst)) != 0) return res;
+	if((res = emitLine("MOV SAR %" PRIu32, src)) != 0) return res;
+	if((res = emitLine("MOV DAR %" PRIu32, buf[0])) != 0) return res;
+	if((res = emitLine("FLUSHP %" PRIu32, rx)) != 0) return res;
+	if((res = emitLine("LPFE")) != 0) return res;
+	for(u32 b = 0; b < 2; b++)
+	{
+		if((res = emitLine("WFE %s", empty[b].c_str())) != 0) return res;
+		res = emitRepeat(requests, [rx]()
+		{
+			int r;
+			if((r = emitLine("WFP %" PRIu32 " burst", rx)) != 0) return r;
+			if((r = emitLine("LDPB %" PRIu32, rx)) != 0) return r;
+			return emitLine("STB");
+		});
+		if(res != 0) return res;
+		if((res = emitLine("WMB")) != 0) return res;
+		if((res = emitLine("SEV %s", full[b].c_str())) != 0) return res;
+		if((res = emitSetAddr("DAR", buf[b] + size, buf[b ^ 1])) != 0) return res;
+	}
+	if((res = emitLine("LPEND")) != 0) return res;
+	if((res = emitLine("END")) != 0) return res;
+	if((res = endProgram((prefix + "_rx").c_str())) != 0) return res;
+
+
+	// Consumer. Both buffers start empty.
+	if((res = beginProgram()) != 0) return res;
+	BurstPlan plan;
+	if(hasTx) plan = {beat, burst, requests, 0};
+	else      plan = planBursts(size, maxBeat(buf[0] | buf[1] | size | dst));
+	if((res = emitCcr(true, !hasTx, plan.beat, plan.len)) != 0) return res;
+	if((res = emitLine("MOV SAR %" PRIu32, buf[0])) != 0) return res;
+	if((res = emitLine("MOV DAR %" PRIu32, dst)) != 0) return res;
+	if(hasTx && (res = emitLine("FLUSHP %" PRIu32, tx)) != 0) return res;
+	if((res = emitLine("SEV %s", empty[0].c_str())) != 0) return res;
+	if((res = emitLine("SEV %s", empty[1].c_str())) != 0) return res;
+	if((res = emitLine("LPFE")) != 0) return res;
+	for(u32 b = 0; b < 2; b++)
+	{
+		if((res = emitLine("WFE %s", full[b].c_str())) != 0) return res;
+		if(hasTx)
+		{
+			res = emitRepeat(requests, [tx]()
+			{
+				int r;
+				if((r = emitLine("WFP %" PRIu32 " burst", tx)) != 0) return r;
+				if((r = emitLine("LDB")) != 0) return r;
+				return emitLine("STPB %" PRIu32, tx);
+			});
+		}
+		else res = emitPlan(plan, true, true, [](){ int r = emitLine("LD"); return (r ? r : emitLine("ST")); });
+		if(res != 0) return res;
+		if((res = emitLine("RMB")) != 0) return res;
+		if((res = emitLine("SEV %s", empty[b].c_str())) != 0) return res;
+		if((res = emitSetAddr("SAR", buf[b] + size, buf[b ^ 1])) != 0) return res;
+		if(!hasTx && b == 1 && (res = emitSetAddr("DAR", dst + 2 * size, dst)) != 0) return res;
+	}
+	if((res = emitLine("LPEND")) != 0) return res;
+	if((res = emitLine("END")) != 0) return res;
+
+	return endProgram((prefix + "_tx").c_str());
+}
+
+// PERIPH_RX periph, width, burstLen
+// PERIPH_TX periph, width, burstLen
+// Services the peripheral until it signals the last request. Burst
+// requests move burstLen beats of width bits, single requests one beat.
+// RX reads the peripheral FIFO at SAR into incrementing memory at DAR,
+// TX writes incrementing memory at SAR to the FIFO at DAR. SAR and DAR
+// must be set up beforehand. Clobbers CCR.
+int emitPeriph(u32 argc, const char *const argv[MAX_TOKENS])
+{
+	if(argc != 4) return ERR_INV_PARSER_ARGS;
+
+	const bool rx = (strcmp(argv[0], "PERIPH_RX") == 0);
+	u32 periph, width, burstLen;
+	if(!parsePeriph(argv[1], periph)) return ERR_OUT_OF_RANGE;
+	if(!parseNum(argv[2], width) || !parseNum(argv[3], burstLen)) return ERR_INV_PARSER_ARGS;
+	if(width < 8 || width > AXI_BUS_BYTES * 8 || (width & (width - 1)) != 0) return ERR_OUT_OF_RANGE;
+
+	// Longest AXI burst dividing the watermark. The remaining
+	// factor is looped with the last burst outside the loop to
+	// send the peripheral acknowledgement.
+	u32 len = std::min(burstLen, MAX_BURST_LEN);
+	while(len > 1 && burstLen % len != 0) len--;
+	if(burstLen == 0 || burstLen / len > 257) return ERR_OUT_OF_RANGE;
+	const u32 bursts = burstLen / len;
+	const u32 beat = width / 8;
+
+	int res;
+	if((res = emitCcr(!rx, rx, beat, len)) != 0) return res;
+	if((res = emitLine("FLUSHP %" PRIu32, periph)) != 0) return res;
+	if((res = emitLine("LPFE")) != 0) return res;
+	if((res = emitLine("WFP %" PRIu32 " periph", periph)) != 0) return res;
+
+	if(bursts > 2)
+	{
+		if((res = emitLine("LP %" PRIu32, bursts - 1)) != 0) return res;
+		if((res = emitLine("LDB")) != 0) return res;
+		if((res = emitLine("STB")) != 0) return res;
+		if((res = emitLine("LPENDB")) != 0) return res;
+	}
+	else if(bursts == 2)
+	{
+		if((res = emitLine("LDB")) != 0) return res;
+		if((res = emitLine("STB")) != 0) return res;
+	}
+	if((res = emitLine((rx ? "LDPB %" PRIu32 : "LDB"), periph)) != 0) return res;
+	if((res = emitLine((rx ? "STB" : "STPB %" PRIu32), periph)) != 0) return res;
+
+	// Single requests share the burst CCR like the TRM example.
+	// The S forms only transfer a single beat for them.
+	if((res = emitLine((rx ? "LDPS %" PRIu32 : "LDS"), periph)) != 0) return res;
+	if((res = emitLine((rx ? "STS" : "STPS %" PRIu32), periph)) != 0) return res;
+
+	return emitLine("LPEND");
+}
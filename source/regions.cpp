@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include "types.h"
+#include "regions.h"
+#include "asmparse.h"
+#include "utils.h"
+#include "errors.h"
+
+
+typedef struct
+{
+	u32 start;
+	u32 end;  // Inclusive.
+	u8  type; // REGION_*
+} Region;
+
+static std::vector<Region> g_regions;
+
+
+
+// Region map format. One region per line:
+// <start> <end inclusive> <device|normal-nc|normal-wb>  # comment
+int loadRegionMap(const char *const path)
+{
+	FILE *fh = fopen(path, "r");
+	if(!fh)
+	{
+		fprintf(stderr, "Failed to open '%s'.\n", path);
+		return ERR_FILE_OPEN;
+	}
+
+	const std::unique_ptr<char[]> inBuf(new(std::nothrow) char[INBUF_SIZE]);
+	if(!inBuf)
+	{
+		fclose(fh);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	g_regions.clear();
+	u32 curLine = 0;
+	int res = 0;
+	while(fgets(inBuf.get(), INBUF_SIZE, fh))
+	{
+		curLine++;
+
+		char *line = const_cast<char*>(findChar(inBuf.get()));
+		if(line == nullptr || *line == '#') continue;
+		strtok(line, "#\n"); // Remove comments and newlines.
+
+		const char *const startStr = strtok(line, " ,\t");
+		const char *const endStr = strtok(nullptr, " ,\t");
+		const char *const typeStr = strtok(nullptr, " ,\t");
+
+		static const char *const typeWlist[3] = {"device", "normal-nc", "normal-wb"};
+		static const u8 types[3] = {REGION_DEVICE, REGION_NORMAL_NC, REGION_NORMAL_WB};
+		Region region;
+		s32 type;
+		if(!endStr || !typeStr || !parseNum(startStr, region.start) || !parseNum(endStr, region.end) ||
+		   region.end < region.start || (type = checkStrList(typeWlist, 3, 0, typeStr)) < 0)
+		{
+			fprintf(stderr, "Error: '%s' line %" PRIu32 ": Invalid region.\n", path, curLine);
+			res = ERR_INV_ARG;
+			break;
+		}
+		region.type = types[type];
+
+		g_regions.push_back(region);
+	}
+
+	fclose(fh);
+
+	return res;
+}
+
+bool regionMapLoaded(void)
+{
+	return !g_regions.empty();
+}
+
+// Returns the fastest cache attributes legal for all regions overlapping
+// first to last inclusive or -1 if none of them is mapped.
+s32 regionRangeCacheAttr(u32 first, u32 last)
+{
+	s32 attr = -1;
+	for(const Region &region : g_regions)
+	{
+		if(region.start > last || region.end < first) continue;
+		attr = (attr < 0 ? region.type : attr & region.type);
+	}
+
+	return attr;
+}
+
+const char* regionTypeName(u32 type)
+{
+	switch(type)
+	{
+		case REGION_DEVICE:    return "device";
+		case REGION_NORMAL_NC: return "normal non-cacheable";
+		case REGION_NORMAL_WB: return "normal write-back";
+	}
+
+	return "unknown";
+}
@@ -0,0 +1,86 @@
+#include <map>
+#include "types.h"
+#include "sim.h"
+#include "program.h"
+#include "disasm.h"
+#include "instructions.h"
+
+
+
+// Bytes of one burst. Beat size and burst length fields start at shift.
+static u32 burstBytes(u32 ccr, u32 sizeShift, u32 lenShift)
+{
+	return (1u<<(ccr>>sizeShift & 7u)) * ((ccr>>lenShift & 0xFu) + 1);
+}
+
+// Runs the program with all waits satisfied immediately and peripherals
+// always sending burst requests. Forever loops end after SIM_FOREVER_ITERS
+// iterations as if the peripheral sent the last request.
+ProgMetrics measureProgram(const Program &prog)
+{
+	const u8 *const code = prog.code.data();
+	const u32 size = prog.code.size();
+
+	ProgMetrics metrics{};
+	u32 pc = 0;
+	u32 ccr = CCR_DEFAULT_VAL;
+	u16 lc[2] = {0};
+	u8 req = COND_BURST;
+	std::map<u32, u32> foreverIters; // DMALPEND position -> iterations taken.
+	for(u32 step = 0; step < SIM_MAX_STEPS; step++)
+	{
+		DecodedInst di;
+		if(!decodeInst(code, size, pc, di)) return metrics;
+		metrics.insts++;
+		metrics.fetchBytes += di.size;
+
+		u32 next = pc + di.size;
+		const bool execute = (di.cond == COND_NONE || di.cond == req);
+		switch(di.op)
+		{
+			case INST_END:
+			case INST_KILL:
+				metrics.complete = true;
+				return metrics;
+			case INST_WFP:
+				req = (di.flags & INST_BIT_BURST || di.flags & INST_BIT_WFP_PERIPH ? COND_BURST : COND_SINGLE);
+				break;
+			case INST_MOV:
+				if(di.flags == 1) ccr = di.imm; // CCR
+				break;
+			case INST_LD:
+			case INST_LDP:
+				if(execute) metrics.loadBytes += burstBytes(ccr, CCR_SRC_BURST_SIZE_SHIFT, CCR_SRC_BURST_LEN_SHIFT);
+				break;
+			case INST_ST:
+			case INST_STP:
+			case INST_STZ:
+				if(execute) metrics.storeBytes += burstBytes(ccr, CCR_DST_BURST_SIZE_SHIFT, CCR_DST_BURST_LEN_SHIFT);
+				break;
+			case INST_LP:
+				lc[di.lc] = di.imm;
+				break;
+			case INST_LPEND:
+				if(!execute) break;
+				if(di.nf)
+				{
+					if(lc[di.lc] != 0)
+					{
+						lc[di.lc]--;
+						next = pc - di.imm;
+					}
+				}
+				else
+				{
+					u32 &iters = foreverIters[pc];
+					if(++iters < SIM_FOREVER_ITERS) next = pc - di.imm;
+					else iters = 0;
+				}
+				break;
+		}
+
+		pc = next;
+	}
+
+	return metrics;
+}
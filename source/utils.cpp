@@ -1,4 +1,5 @@
 #include <cstring>
+#include <cstdlib>
 #include "utils.h"
 
 
@@ -44,6 +45,19 @@ s32 checkStrList(const char *const list[], u32 lSize, u32 cmpSize, const char *c
 	return res;
 }
 
+// Parses a decimal, hex or octal number. The whole string must be a number.
+bool parseNum(const char *const str, u32 &val)
+{
+	if(*str < '0' || *str > '9') return false;
+
+	char *end;
+	const unsigned long long tmp = strtoull(str, &end, 0);
+	if(*end != '\0' || tmp > 0xFFFFFFFFu) return false;
+	val = static_cast<u32>(tmp);
+
+	return true;
+}
+
 // Assumes no newline at the end of the string.
 /*const char* findWhitespace(const char *str)
 {
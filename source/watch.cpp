@@ -0,0 +1,278 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+#include <chrono>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include "types.h"
+#include "watch.h"
+#include "asmparse.h"
+#include "program.h"
+#include "c_header_gen.h"
+#include "regions.h"
+#include "profile.h"
+#include "errors.h"
+
+
+typedef struct
+{
+	bool valid;
+	off_t size;
+	struct timespec mtime;
+} FileStamp;
+
+// Connected client with the bytecode not sent yet. Clients which don't read
+// never stall the watch loop. They get at most the message being sent and
+// the latest one behind it.
+typedef struct
+{
+	int fd;
+	std::vector<u8> out;
+	size_t sent;
+	std::vector<u8> next;
+} Client;
+
+static volatile sig_atomic_t g_stop = 0;
+
+
+
+static void stopHandler(int)
+{
+	g_stop = 1;
+}
+
+// Missing files count as unchanged. Editors may replace them while saving.
+static bool fileChanged(const char *const path, FileStamp &stamp)
+{
+	struct stat st;
+	if(stat(path, &st) != 0) return false;
+
+	if(stamp.valid && stamp.size == st.st_size && stamp.mtime.tv_sec == st.st_mtim.tv_sec &&
+	   stamp.mtime.tv_nsec == st.st_mtim.tv_nsec) return false;
+
+	stamp.valid = true;
+	stamp.size = st.st_size;
+	stamp.mtime = st.st_mtim;
+
+	return true;
+}
+
+static int openServer(const char *const path)
+{
+	struct sockaddr_un addr{};
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path '%s' is too long.\n", path);
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return -1;
+
+	unlink(path);
+	if(bind(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, MAX_CLIENTS) != 0)
+	{
+		fprintf(stderr, "Failed to listen on '%s'.\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void putU32(std::vector<u8> &msg, u32 val)
+{
+	for(u32 i = 0; i < 4; i++) msg.push_back(val>>(i * 8));
+}
+
+// Little endian message:
+// u32 message size, u32 number of programs and for each program
+// u32 name length, name, u32 code size, code.
+static std::vector<u8> makeMessage(const std::vector<Program> &progs)
+{
+	std::vector<u8> msg(4);
+	putU32(msg, progs.size());
+	for(const Program &prog : progs)
+	{
+		putU32(msg, prog.name.size());
+		msg.insert(msg.end(), prog.name.cbegin(), prog.name.cend());
+		putU32(msg, prog.code.size());
+		msg.insert(msg.end(), prog.code.cbegin(), prog.code.cend());
+	}
+
+	const u32 size = msg.size();
+	memcpy(msg.data(), &size, 4);
+
+	return msg;
+}
+
+// Sends as much as possible without blocking. Returns false if the client is gone.
+static bool flushClient(Client &client)
+{
+	while(client.sent < client.out.size())
+	{
+		const ssize_t res = send(client.fd, &client.out[client.sent], client.out.size() - client.sent,
+		                         MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+		if(res <= 0) return false;
+
+		client.sent += res;
+		if(client.sent == client.out.size() && !client.next.empty())
+		{
+			client.out = std::move(client.next);
+			client.next.clear();
+			client.sent = 0;
+		}
+	}
+
+	return true;
+}
+
+static void queueMessage(Client &client, const std::vector<u8> &msg)
+{
+	// Messages can't be cut off once started. Newer ones replace unsent ones.
+	if(client.sent == 0 || client.sent == client.out.size())
+	{
+		client.out = msg;
+		client.sent = 0;
+	}
+	else client.next = msg;
+}
+
+static void dropClient(std::vector<Client> &clients, u32 i)
+{
+	close(clients[i].fd);
+	clients.erase(clients.begin() + i);
+}
+
+static void pushToClients(std::vector<Client> &clients, const std::vector<u8> &msg)
+{
+	for(u32 i = clients.size(); i-- > 0;)
+	{
+		queueMessage(clients[i], msg);
+		if(!flushClient(clients[i])) dropClient(clients, i);
+	}
+}
+
+// Accepts new clients, drops disconnected ones and continues sending
+// to slow ones. Sends the last bytecode to new clients right away.
+static void serveClients(int serverFd, std::vector<Client> &clients, const std::vector<u8> &msg)
+{
+	std::vector<struct pollfd> fds{{serverFd, POLLIN, 0}};
+	for(const Client &client : clients)
+	{
+		const short events = POLLIN | (client.sent < client.out.size() ? POLLOUT : 0);
+		fds.push_back({client.fd, events, 0});
+	}
+	if(poll(fds.data(), fds.size(), WATCH_POLL_MS) <= 0) return;
+
+	for(u32 i = fds.size() - 1; i > 0; i--)
+	{
+		const short revents = fds[i].revents;
+		if(!revents) continue;
+
+		// Clients don't send anything. Readable means closed.
+		u8 discard[64];
+		if((revents & (POLLIN | POLLERR | POLLHUP)) && recv(fds[i].fd, discard, sizeof(discard), MSG_DONTWAIT) <= 0)
+		{
+			dropClient(clients, i - 1);
+		}
+		else if((revents & POLLOUT) && !flushClient(clients[i - 1])) dropClient(clients, i - 1);
+	}
+
+	if(fds[0].revents & POLLIN)
+	{
+		const int fd = accept(serverFd, nullptr, nullptr);
+		if(fd < 0) return;
+		if(clients.size() >= MAX_CLIENTS)
+		{
+			close(fd);
+			return;
+		}
+
+		clients.push_back(Client{fd, msg, 0, {}});
+		if(!flushClient(clients.back())) dropClient(clients, clients.size() - 1);
+	}
+}
+
+// Stays resident and reassembles whenever an input file, the region map or
+// the profile changes. Unchanged blocks of the sources are reused. The result
+// is written to outFile and pushed to all clients connected to the socket
+// until SIGINT/SIGTERM.
+int watchFiles(const char *const inFiles[], u32 numFiles, const char *const outFile, const AsmOpts &opts)
+{
+	int res;
+	FileStamp regionStamp{}, profileStamp{};
+	if(opts.regionFile) fileChanged(opts.regionFile, regionStamp);
+	if(opts.profileFile) fileChanged(opts.profileFile, profileStamp);
+	if(opts.regionFile && (res = loadRegionMap(opts.regionFile)) != 0) return res;
+	if(opts.profileFile && (res = loadProfile(opts.profileFile)) != 0) return res;
+
+	int serverFd = -1;
+	if(opts.socketPath && (serverFd = openServer(opts.socketPath)) < 0) return ERR_SOCKET;
+
+	signal(SIGINT, stopHandler);
+	signal(SIGTERM, stopHandler);
+
+	AsmOpts cacheOpts = opts;
+	cacheOpts.cache = true;
+
+	std::vector<FileStamp> stamps(numFiles, FileStamp{});
+	std::vector<Client> clients;
+	std::vector<u8> msg;
+	std::vector<Program> progs;
+	std::vector<EventSymbol> eventSyms;
+	int regionRes = 0, profileRes = 0; // A broken map or profile fails all assemblies until fixed.
+	while(!g_stop)
+	{
+		bool changed = false;
+		for(u32 i = 0; i < numFiles; i++) changed |= fileChanged(inFiles[i], stamps[i]);
+		if(opts.regionFile && fileChanged(opts.regionFile, regionStamp))
+		{
+			regionRes = loadRegionMap(opts.regionFile);
+			changed = true;
+		}
+		if(opts.profileFile && fileChanged(opts.profileFile, profileStamp))
+		{
+			profileRes = loadProfile(opts.profileFile);
+			changed = true;
+		}
+
+		if(changed)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			res = (regionRes ? regionRes : profileRes);
+			if(res == 0) res = assemblePrograms(inFiles, numFiles, cacheOpts, progs, eventSyms);
+			if(res == 0) res = (opts.binary ? writeBinary(progs, outFile) : makeCHeader(progs, eventSyms, outFile));
+			if(res == 0)
+			{
+				msg = makeMessage(progs);
+				pushToClients(clients, msg);
+			}
+			const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+
+			if(res == 0) printf("Assembled in %.3f ms.\n", took.count());
+			else         printf("Assembly failed (%d). Waiting for changes...\n", res);
+			fflush(stdout);
+		}
+
+		if(serverFd >= 0) serveClients(serverFd, clients, msg);
+		else              usleep(WATCH_POLL_MS * 1000);
+	}
+
+	for(const Client &client : clients) close(client.fd);
+	if(serverFd >= 0)
+	{
+		close(serverFd);
+		unlink(opts.socketPath);
+	}
+
+	return 0;
+}